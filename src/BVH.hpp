@@ -1,11 +1,23 @@
 #pragma once
 
 #include <tuple>
+#include <new>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "Vector.hpp"
 #include "Triangle.hpp"
 #include "Mesh.hpp"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "utils/RadixSort.hpp"
 #include "utils/cuda_ready.hpp"
 
 class BoundingBox {
@@ -49,6 +61,12 @@ class BoundingBox {
             }
         }
 
+        __host__ __device__ void growToInclude(const IndexedMesh& mesh) {
+            for (uint i=0; i<mesh.getNumVertices(); i++) {
+                growToInclude(mesh.getPosition(i));
+            }
+        }
+
         __host__ __device__ Vector<float> getMin() const {
             return min;
         }
@@ -57,6 +75,13 @@ class BoundingBox {
             return max;
         }
 
+        __host__ __device__ BoundingBox intersection(const BoundingBox& other) const {
+            BoundingBox box;
+            box.min = min.max(other.min);
+            box.max = max.min(other.max);
+            return box;
+        }
+
         __host__ __device__ Vector<float> getCenter() const {
             return (min + max) * 0.5;
         }
@@ -66,216 +91,987 @@ class BoundingBox {
         }
 };
 
-class Node {
+/*
+32 bytes node, siblings are stored next to each other so that both child boxes share one 64 bytes cache line.
+That needs node arrays starting on a cache line, new Node[] allocates them so (Array<Node> included), alignas(32) alone would not.
+index holds the first triangle of a leaf or the first child of an interior node, LEAF_FLAG tells them apart.
+PENDING_FLAG in count marks a leaf of a lazy build, still to be split by the first ray entering it.
+*/
+class alignas(32) Node {
     private:
-        BoundingBox bounds;
-        uint triangleIndex = 0;
-        uint triangleCount = 0;
-        uint childIndex = 0;
-        
+        static constexpr uint LEAF_FLAG = 0x80000000u;
+        static constexpr uint PENDING_FLAG = 0x80000000u;
+
+        float minX = INFINITY, minY = INFINITY, minZ = INFINITY;
+        uint index = 0;
+        float maxX = -INFINITY, maxY = -INFINITY, maxZ = -INFINITY;
+        uint count = 0;
+
     public:
 
         __host__ __device__ Node() {};
-        __host__ __device__ Node(const uint triangleIndex) : triangleIndex(triangleIndex) {};
-        __host__ __device__ Node(BoundingBox bounds) : bounds(bounds) {};
-        __host__ __device__ Node(const Node& other) {
-            bounds = other.bounds;
-            triangleIndex = other.triangleIndex;
-            triangleCount = other.triangleCount;
-            childIndex = other.childIndex;
+        __host__ __device__ Node(const uint triangleIndex) : index(triangleIndex | LEAF_FLAG) {};
+        __host__ __device__ Node(BoundingBox bounds) {
+            setBoundingBox(bounds);
         };
 
-        __host__ __device__ ~Node() {};
+        __host__ __device__ void addToBoundingBox(const Triangle& tri) {
+            addToBoundingBox(tri.getMin(), tri.getMax());
+        }
 
-        __host__ __device__ Node operator=(const Node& other) {
-            if (this != &other) {
-                bounds = other.bounds;
-                triangleIndex = other.triangleIndex;
-                triangleCount = other.triangleCount;
-                childIndex = other.childIndex;
-            }
-            return *this;
+        __host__ __device__ void addToBoundingBox(const BoundingBox& box) {
+            addToBoundingBox(box.getMin(), box.getMax());
         }
 
-        __host__ __device__ void addToBoundingBox(const Triangle& tri) {
-            bounds.growToInclude(tri);
+        __host__ __device__ void addToBoundingBox(const Vector<float>& mini, const Vector<float>& maxi) {
+            minX = Utils::min(minX, mini.getX()); minY = Utils::min(minY, mini.getY()); minZ = Utils::min(minZ, mini.getZ());
+            maxX = Utils::max(maxX, maxi.getX()); maxY = Utils::max(maxY, maxi.getY()); maxZ = Utils::max(maxZ, maxi.getZ());
+        }
+
+        __host__ __device__ void setBoundingBox(const BoundingBox& box) {
+            minX = box.getMin().getX(); minY = box.getMin().getY(); minZ = box.getMin().getZ();
+            maxX = box.getMax().getX(); maxY = box.getMax().getY(); maxZ = box.getMax().getZ();
         }
 
         __host__ __device__ BoundingBox getBoundingBox() const {
-            return bounds;
+            BoundingBox box;
+            box.growToInclude(getMin(), getMax());
+            return box;
+        }
+
+        __host__ __device__ Vector<float> getMin() const {
+            return Vector<float>(minX, minY, minZ);
+        }
+
+        __host__ __device__ Vector<float> getMax() const {
+            return Vector<float>(maxX, maxY, maxZ);
+        }
+
+        __host__ __device__ bool isLeaf() const {
+            return index & LEAF_FLAG;
         }
 
         __host__ __device__ void setChildIndex(const uint idx) {
-            childIndex = idx;
+            index = idx & ~LEAF_FLAG;
         }
 
         __host__ __device__ uint getChildIndex() const {
-            return childIndex;
+            return index & ~LEAF_FLAG;
         }
 
         __host__ __device__ void setTriangleIndex(const uint idx) {
-            triangleIndex = idx;
+            index = idx | LEAF_FLAG;
         }
 
         __host__ __device__ uint getTriangleIndex() const {
-            return triangleIndex;
+            return index & ~LEAF_FLAG;
         }
 
-        __host__ __device__ void setTriangleCount(const uint count) {
-            triangleCount = count;
+        __host__ __device__ void setTriangleCount(const uint c) {
+            count = c;
         }
 
         __host__ __device__ uint getTriangleCount() const {
-            return triangleCount;
+            return count & ~PENDING_FLAG;
+        }
+
+        __host__ __device__ void setPending(const uint triangleIndex, const uint triangleCount) {
+            index = triangleIndex | LEAF_FLAG;
+            count = triangleCount | PENDING_FLAG;
+        }
+
+        // Expanded nodes are published by other threads : count is written last and read first
+        __host__ bool isPending() const {
+            const uint c = *(volatile const uint*)&count;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return c & PENDING_FLAG;
+        }
+
+        __host__ void publish(const Node& expanded) {
+            index = expanded.index;
+            std::atomic_thread_fence(std::memory_order_release);
+            *(volatile uint*)&count = expanded.count;
         }
+
+        static constexpr size_t ARRAY_ALIGNMENT = 64;
+
+        __host__ static void* operator new[](const size_t size) {
+            return ::operator new[](size, std::align_val_t(ARRAY_ALIGNMENT));
+        }
+
+        __host__ static void* operator new[](const size_t size, std::align_val_t) {
+            return ::operator new[](size, std::align_val_t(ARRAY_ALIGNMENT));
+        }
+
+        __host__ static void operator delete[](void* p) {
+            ::operator delete[](p, std::align_val_t(ARRAY_ALIGNMENT));
+        }
+
+        __host__ static void operator delete[](void* p, std::align_val_t) {
+            ::operator delete[](p, std::align_val_t(ARRAY_ALIGNMENT));
+        }
+};
+
+static_assert(sizeof(Node) == 32, "Node must stay 32 bytes so that siblings share a cache line");
+static_assert(std::is_trivially_destructible<Node>::value, "new Node[] must not prepend an array cookie, it would break the alignment");
+
+// Memory order of the nodes once built, sibling pairs always stay adjacent
+enum class NodeLayout {
+    Build, // Allocation order of the builder, subtrees built by other threads end up at the back
+    DepthFirst, // Pairs in depth first order, a subtree is contiguous
+    VanEmdeBoas // Cache oblivious : recursively top half of the levels first, then each bottom subtree
+};
+
+struct BVHParams {
+    uint numBins = 16; // Centroid bins per axis for the SAH sweep, at most BVH::maxBins
+    float traversalCost = 1.f; // Cost of visiting an interior node
+    float intersectionCost = 1.f; // Cost of one ray/triangle test, or of one TriangleBlock test when blockWidth > 1
+    // Triangles tested together in a leaf, a leaf costs the number of blocks it spans. The device tests them one by one
+#ifdef HOST_ONLY
+    uint blockWidth = TriangleBlock::WIDTH;
+#else
+    uint blockWidth = 1;
+#endif
+    uint maxDepth = 64; // Safety net only, the traversal stack holds BVH::STACK_SIZE entries
+    float rebuildThreshold = 1.5f; // update() rebuilds once the refitted SAH cost exceeds the built one by this factor
+    bool spatialSplits = false; // SBVH : triangles straddling a split plane may be clipped and referenced on both sides
+    float spatialSplitAlpha = 1E-5f; // Spatial splits are only tried when the object split children overlap more than this fraction of the root area
+    float maxDuplication = 0.3f; // Extra triangle references allowed by spatial splits, as a fraction of the triangle count
+    bool linearBuild = false; // LBVH : Morton order instead of SAH, much faster to build but slower to trace
+    uint linearLeafSize = 4; // LBVH ranges at most this large become leaves
+    uint parallelThreshold = 4096; // SAH subtrees with at least this many triangles are built by OpenMP tasks
+    bool lazyBuild = false; // SAH only : subtrees above lazyThreshold triangles are split by the first ray entering them, see BVH::expand
+    uint lazyThreshold = 8192;
+    NodeLayout layout = NodeLayout::DepthFirst;
 };
 
 class BVH : public CudaReady {
+    public:
+        static constexpr uint STACK_SIZE = 128; // Traversal stack of Ray::rayTriangleBVH, see BVHStats::maxStackDepth
+
     private:
-        uint maxDepth = 5;
-    
+        static constexpr uint maxBins = 64;
+        BVHParams params;
+        float builtSAHCost = 0.f;
+
+        struct Bin {
+            BoundingBox bounds;
+            uint count = 0;
+        };
+
+        // SBVH reference : a triangle together with the part of its box that falls in the current node
+        struct Reference {
+            BoundingBox bounds;
+            uint triangle;
+        };
+
+        struct SpatialBin {
+            BoundingBox bounds;
+            uint entries = 0;
+            uint exits = 0;
+        };
+
+        uint duplicationBudget = 0;
+
+        // Shared by the copies of a lazy BVH : expansions append their nodes to the storage reserved by build(), which never moves
+        struct LazyBuild {
+            std::mutex mutex;
+            std::condition_variable expanded;
+            std::unordered_map<uint, uint> depths; // Pending node -> depth
+            std::unordered_set<uint> claimed; // Pending nodes being expanded
+            uint numNodes = 0;
+        };
+        LazyBuild* lazy = nullptr;
+
     public:
         Array<Node> allNodes;
-        Mesh allTriangles;
+        IndexedMesh mesh; // Shared with the scene, never reordered
+        Array<uint> triangleIndices; // BVH order -> mesh triangle
+        Array<TriangleEdges> allEdges; // BVH order
+        Array<TriangleBlock> allBlocks; // CPU only, the triangles of each leaf packed by TriangleBlock::WIDTH, empty for lazy builds
+        Array<uint> leafBlocks; // Node -> first block of its triangles in allBlocks
     
         __host__ BVH() {}; 
-        __host__ BVH(const Mesh mesh) : allTriangles(mesh) {
+        __host__ BVH(const IndexedMesh _mesh) : BVH(_mesh, BVHParams()) {};
+
+        __host__ BVH(const IndexedMesh _mesh, const BVHParams _params) : params(_params), mesh(_mesh) {
+            build();
+        };
+
+        // Already built tree, see BVHCache
+        __host__ BVH(const IndexedMesh _mesh, const BVHParams _params, const Array<Node> nodes, const Array<uint> indices, const Array<TriangleEdges> edges, const float sahCost)
+            : params(_params), builtSAHCost(sahCost), allNodes(nodes), mesh(_mesh), triangleIndices(indices), allEdges(edges) {
+            computeBlocks();
+        };
+
+        __host__ void build() {
             BoundingBox bounds;
             bounds.growToInclude(mesh);
 
+            allNodes.free();
+            allNodes = Array<Node>();
             allNodes.push_back(Node(bounds));
-            split(0, 0, allTriangles.size(), 0);
-        };
+            allNodes.push_back(Node(0u)); // Padding (empty leaf), so that every sibling pair starts on an even index
 
-         __host__ BVH(const Mesh mesh, const uint _maxDepth) : BVH(mesh) {
-            maxDepth = _maxDepth;
-         };
+            triangleIndices.free();
+            triangleIndices = Array<uint>();
+            if (params.linearBuild) {
+                buildLinear();
+            } else if (params.spatialSplits) {
+                std::vector<Reference> refs;
+                for (uint i = 0; i < mesh.size(); i++) {
+                    refs.push_back({BoundingBox(), i});
+                    refs.back().bounds.growToInclude(mesh.getMin(i), mesh.getMax(i));
+                }
+                duplicationBudget = (uint)(params.maxDuplication * mesh.size());
+                splitSpatial(0, refs, 0, HalfArea(bounds));
+            } else {
+                for (uint i = 0; i < mesh.size(); i++) {
+                    triangleIndices.push_back(i);
+                }
+                std::vector<Node> nodes = {allNodes[0], allNodes[1]};
+#ifdef _OPENMP
+                const bool inTeam = omp_in_parallel();
+#else
+                const bool inTeam = true;
+#endif
+                if (inTeam) {
+                    // Subtree tasks join the enclosing team, e.g. compute_bvhs building meshes in parallel
+                    split(nodes, 0, 0, triangleIndices.size(), 0);
+                } else {
+                    #pragma omp parallel
+                    #pragma omp single
+                    split(nodes, 0, 0, triangleIndices.size(), 0);
+                }
+                allNodes.free();
+                allNodes = Array<Node>(nodes.data(), nodes.size());
+            }
+            reorder(params.layout);
+            computeEdges();
+            prepareLazy();
+            builtSAHCost = computeSAHCost();
+        }
 
-        __host__ static float NodeCost(const Vector<float>& size, const int numTriangles) {
-            float halfArea = size.getX() * size.getY() + size.getX() * size.getZ() + size.getY() * size.getZ();
-            return halfArea * numTriangles;
+        __host__ bool isLazy() const {
+            return lazy != nullptr;
         }
 
-        __host__ float evaluateSplit(const uint splitAxis, const float splitPos, const uint start, const uint count)
-    {
-        BoundingBox boundsLeft;
-        BoundingBox boundsRight;
-        uint numOnLeft = 0;
-        uint numOnRight = 0;
+        /*
+        Splits a pending node of a lazy build, its children above lazyThreshold staying pending in turn.
+        The first thread asking builds it and the others wait for it. Only the pending triangle range is touched,
+        and the tree a BVH stands for does not change, so this is allowed on a const BVH.
+        */
+        __host__ void expand(const uint nodeIndex) const {
+            BVH& self = const_cast<BVH&>(*this);
+            std::unique_lock<std::mutex> lock(lazy->mutex);
+            while (true) {
+                if (!allNodes[nodeIndex].isPending()) {
+                    self.allNodes.resize(lazy->numNodes); // Nodes may have been appended through another copy
+                    return;
+                }
+                if (lazy->claimed.insert(nodeIndex).second) break;
+                lazy->expanded.wait(lock);
+            }
+            const Node pending = allNodes[nodeIndex];
+            const uint depth = lazy->depths[nodeIndex];
+            lock.unlock();
+
+            const uint start = pending.getTriangleIndex();
+            const uint count = pending.getTriangleCount();
+            std::vector<Node> nodes = {Node(pending.getBoundingBox()), Node(0u)};
+            self.split(nodes, 0, start, count, depth, true);
+            for (uint i = start; i < start + count; i++) {
+                self.allEdges[i] = mesh.getEdges(triangleIndices[i]);
+            }
+            std::vector<std::pair<uint, uint>> pendingNodes;
+            FindPending(nodes, depth, pendingNodes);
 
-        for (int i = start; i < start + count; i++)
-        {
-            Triangle tri = allTriangles[i];
-            if (tri.getBarycenter()[splitAxis] < splitPos)
-            {
-                boundsLeft.growToInclude(tri);
-                numOnLeft++;
+            lock.lock();
+            // Same relocation as merge(), into the reserved storage. The node itself is published last.
+            const uint offset = lazy->numNodes - 2;
+            auto relocate = [offset](Node node) {
+                if (!node.isLeaf()) node.setChildIndex(node.getChildIndex() + offset);
+                return node;
+            };
+            for (uint i = 2; i < nodes.size(); i++) {
+                self.allNodes[offset + i] = relocate(nodes[i]);
             }
-            else
-            {
-                boundsRight.growToInclude(tri);
-                numOnRight++;
+            lazy->numNodes += nodes.size() - 2;
+            self.allNodes.resize(lazy->numNodes);
+            for (const auto& [index, nodeDepth] : pendingNodes) {
+                lazy->depths[index + offset] = nodeDepth;
             }
+            self.allNodes[nodeIndex].publish(relocate(nodes[0]));
+            lazy->depths.erase(nodeIndex);
+            lazy->claimed.erase(nodeIndex);
+            lock.unlock();
+            lazy->expanded.notify_all();
         }
 
-        float costA = NodeCost(boundsLeft.getSize(), numOnLeft);
-        float costB = NodeCost(boundsRight.getSize(), numOnRight);
-        return costA + costB;
-    }
+        // Whole tree, for the users that cannot expand on the way : the device, BVHCache, BVH4 and QBVH
+        __host__ void expandAll() const {
+            if (lazy == nullptr) return;
+            std::vector<uint> stack = {0};
+            while (!stack.empty()) {
+                const uint index = stack.back();
+                stack.pop_back();
+                if (allNodes[index].isPending()) expand(index);
+                const Node& node = allNodes[index];
+                if (!node.isLeaf()) {
+                    stack.push_back(node.getChildIndex() + 0);
+                    stack.push_back(node.getChildIndex() + 1);
+                }
+            }
+            std::lock_guard<std::mutex> lock(lazy->mutex);
+            const_cast<BVH&>(*this).allNodes.resize(lazy->numNodes);
+        }
 
-        __host__ std::tuple<uint, float, float> chooseSplit(const Node& node, const uint start, const uint count) {
+        // Recompute every box bottom-up after the mesh vertices moved, the topology is kept.
+        // SBVH leaves get their whole triangle boxes back, which stays correct but looser.
+        __host__ void refit() {
+            refitBounds();
+            computeEdges();
+        }
+
+        __host__ void refitBounds() {
+            // Children are always stored after their parent
+            for (int i = allNodes.size() - 1; i >= 0; i--) {
+                Node& node = allNodes[i];
+                BoundingBox bounds;
+                if (node.isLeaf()) {
+                    for (uint j = node.getTriangleIndex(); j < node.getTriangleIndex() + node.getTriangleCount(); j++) {
+                        bounds.growToInclude(mesh.getMin(triangleIndices[j]), mesh.getMax(triangleIndices[j]));
+                    }
+                } else {
+                    bounds.growToInclude(allNodes[node.getChildIndex() + 0].getMin(), allNodes[node.getChildIndex() + 0].getMax());
+                    bounds.growToInclude(allNodes[node.getChildIndex() + 1].getMin(), allNodes[node.getChildIndex() + 1].getMax());
+                }
+                node.setBoundingBox(bounds);
+            }
+        }
+
+        // Refit, then rebuild if the tree quality dropped too much. Returns true on rebuild.
+        __host__ bool update() {
+            refit();
+            if (computeSAHCost() > builtSAHCost * params.rebuildThreshold) {
+                build();
+                return true;
+            }
+            return false;
+        }
+
+        /*
+        Rewrites allNodes in the given layout, working on sibling pairs (one 64 bytes line each, the root sharing its pair with the padding).
+        Leaf triangle ranges are rewritten in the new leaf order as well, allEdges has to be recomputed afterwards.
+        */
+        __host__ void reorder(const NodeLayout layout) {
+            if (layout == NodeLayout::Build || allNodes.size() <= 2) return;
+
+            const uint numPairs = allNodes.size() / 2;
+            auto childPairs = [&](const uint pair, std::vector<uint>& out) {
+                for (uint k = 0; k < 2; k++) {
+                    const Node& node = allNodes[2*pair + k];
+                    if (!node.isLeaf()) out.push_back(node.getChildIndex() / 2);
+                }
+            };
+
+            std::vector<uint> order; // New position -> old pair
+            order.reserve(numPairs);
+            if (layout == NodeLayout::DepthFirst) {
+                std::vector<uint> stack = {0};
+                std::vector<uint> children;
+                while (!stack.empty()) {
+                    const uint pair = stack.back();
+                    stack.pop_back();
+                    order.push_back(pair);
+                    children.clear();
+                    childPairs(pair, children);
+                    // First child pushed last, so that it is laid out right after its parent
+                    for (int i = children.size() - 1; i >= 0; i--) stack.push_back(children[i]);
+                }
+            } else {
+                std::vector<uint> heights(numPairs, 1);
+                // Children pairs always come after their parent pair, whatever the layout
+                for (int pair = numPairs - 1; pair >= 0; pair--) {
+                    std::vector<uint> children;
+                    childPairs(pair, children);
+                    for (const uint child : children) heights[pair] = Utils::max(heights[pair], heights[child] + 1);
+                }
+                layoutVanEmdeBoas(0, heights[0], order, childPairs);
+            }
+
+            std::vector<uint> newPair(numPairs);
+            for (uint i = 0; i < order.size(); i++) newPair[order[i]] = i;
+
+            Array<Node> nodes = Array<Node>(allNodes.size());
+            Array<uint> indices = Array<uint>();
+            for (uint i = 0; i < order.size(); i++) {
+                for (uint k = 0; k < 2; k++) {
+                    Node node = allNodes[2*order[i] + k];
+                    if (!node.isLeaf()) {
+                        node.setChildIndex(2*newPair[node.getChildIndex() / 2]);
+                    } else if (2*i + k != 1) {
+                        const uint first = indices.size();
+                        for (uint j = 0; j < node.getTriangleCount(); j++) {
+                            indices.push_back(triangleIndices[node.getTriangleIndex() + j]);
+                        }
+                        node.setTriangleIndex(first);
+                    }
+                    nodes.push_back(node);
+                }
+            }
+            allNodes.free();
+            triangleIndices.free();
+            allNodes = nodes;
+            triangleIndices = indices;
+        }
+
+        __host__ float getBuiltSAHCost() const {
+            return builtSAHCost;
+        }
+
+        __host__ void computeEdges() {
+            allEdges.free();
+            allEdges = Array<TriangleEdges>(triangleIndices.size());
+            for (uint i = 0; i < triangleIndices.size(); i++) {
+                allEdges.push_back(mesh.getEdges(triangleIndices[i]));
+            }
+            computeBlocks();
+        }
+
+        // Leaves of a lazy build only appear while tracing, they keep the one by one test
+        __host__ void computeBlocks() {
+            allBlocks.free();
+            leafBlocks.free();
+            allBlocks = Array<TriangleBlock>();
+            leafBlocks = Array<uint>();
+            if (params.lazyBuild) return;
+            for (uint i = 0; i < allNodes.size(); i++) {
+                const Node& node = allNodes[i];
+                leafBlocks.push_back(allBlocks.size());
+                if (!node.isLeaf()) continue;
+                for (uint j = 0; j < node.getTriangleCount(); j += TriangleBlock::WIDTH) {
+                    TriangleBlock block = {};
+                    for (uint k = 0; k < TriangleBlock::WIDTH && j + k < node.getTriangleCount(); k++) {
+                        block.set(k, allEdges[node.getTriangleIndex() + j + k]);
+                    }
+                    allBlocks.push_back(block);
+                }
+            }
+        }
+
+        __host__ bool hasBlocks() const {
+            return allBlocks.size() > 0;
+        }
+
+        __host__ __device__ uint size() const {
+            return triangleIndices.size();
+        }
+
+        // Intersection tests of a leaf holding count triangles
+        __host__ uint leafTests(const uint count) const {
+            if (params.blockWidth <= 1) return count;
+            return (count + params.blockWidth - 1) / params.blockWidth;
+        }
+
+        __host__ static float HalfArea(const BoundingBox& bounds) {
+            const Vector<float> size = bounds.getSize();
+            if (size.getX() < 0 || size.getY() < 0 || size.getZ() < 0) return 0.f; // Empty box
+            return size.getX() * size.getY() + size.getX() * size.getZ() + size.getY() * size.getZ();
+        }
+
+        // Binned SAH : one pass to fill the centroid bins, then a sweep from each side.
+        // Returns (axis, position, sum of area * count over both children), the cost is not normalized.
+        template <typename Centroid, typename Grow>
+        __host__ std::tuple<uint, float, float> binnedSplit(const uint count, Centroid centroid, Grow grow) const {
             if (count <= 1) return std::make_tuple<uint, float, float>(0, 0, INFINITY);
 
+            BoundingBox centroidBounds;
+            for (uint i = 0; i < count; i++) {
+                centroidBounds.growToInclude(centroid(i));
+            }
+
+            const uint numBins = Utils::max(2u, Utils::min(params.numBins, maxBins));
+            Bin bins[maxBins];
+            float rightCost[maxBins];
+
             float bestSplitPos = 0;
             uint bestSplitAxis = 0;
-            const uint numSplitTests = 5;
-
             float bestCost = INFINITY;
 
-            // Estimate best split pos
-            for (int axis = 0; axis < 3; axis++) {
-                for (int i = 0; i < numSplitTests; i++) {
-                    float splitT = (i + 1) / (numSplitTests + 1.);
-                    float splitPos = Utils::smoothStep(node.getBoundingBox().getMin()[axis], node.getBoundingBox().getMax()[axis], splitT);
-                    float cost = evaluateSplit(axis, splitPos, start, count);
+            for (uint axis = 0; axis < 3; axis++) {
+                const float cmin = centroidBounds.getMin()[axis];
+                const float extent = centroidBounds.getMax()[axis] - cmin;
+                if (extent <= 0) continue; // All centroids on the same plane
+
+                for (uint b = 0; b < numBins; b++) bins[b] = Bin();
+
+                const float scale = numBins / extent;
+                for (uint i = 0; i < count; i++) {
+                    const uint b = Utils::min(numBins - 1, (uint)((centroid(i)[axis] - cmin) * scale));
+                    grow(i, bins[b].bounds);
+                    bins[b].count++;
+                }
+
+                // Right to left sweep : cost of everything above each plane
+                BoundingBox rightBounds;
+                uint rightCount = 0;
+                for (uint b = numBins - 1; b > 0; b--) {
+                    rightBounds.growToInclude(bins[b].bounds.getMin(), bins[b].bounds.getMax());
+                    rightCount += bins[b].count;
+                    rightCost[b - 1] = HalfArea(rightBounds) * leafTests(rightCount);
+                }
+
+                // Left to right sweep, planes are between bin b and b+1
+                BoundingBox leftBounds;
+                uint leftCount = 0;
+                for (uint b = 0; b < numBins - 1; b++) {
+                    leftBounds.growToInclude(bins[b].bounds.getMin(), bins[b].bounds.getMax());
+                    leftCount += bins[b].count;
+                    if (leftCount == 0 || leftCount == count) continue;
+
+                    const float cost = HalfArea(leftBounds) * leafTests(leftCount) + rightCost[b];
                     if (cost < bestCost) {
                         bestCost = cost;
-                        bestSplitPos = splitPos;
+                        bestSplitPos = cmin + (b + 1) / scale;
                         bestSplitAxis = axis;
                     }
                 }
             }
+            return std::make_tuple(bestSplitAxis, bestSplitPos, bestCost);
+        }
+
+        // SAH expected cost of a split, from the raw cost of its children
+        __host__ float normalizeCost(const float rawCost, const float parentArea, const uint count) const {
+            if (rawCost == INFINITY) return INFINITY;
+            return params.traversalCost + params.intersectionCost * (parentArea > 0 ? rawCost / parentArea : leafTests(count));
+        }
+
+        __host__ std::tuple<uint, float, float> chooseSplit(const Node& node, const uint start, const uint count) {
+            std::tuple<uint, float, float> best = binnedSplit(count,
+                [&](const uint i) { return mesh.getBarycenter(triangleIndices[start + i]); },
+                [&](const uint i, BoundingBox& box) { box.growToInclude(mesh.getMin(triangleIndices[start + i]), mesh.getMax(triangleIndices[start + i])); });
+            std::get<2>(best) = normalizeCost(std::get<2>(best), HalfArea(node.getBoundingBox()), count);
+            return best;
+        }
+
+        // Box of the part of a triangle lying between lo and hi along axis, kept inside the reference box
+        __host__ BoundingBox clipTriangle(const Reference& ref, const uint axis, const float lo, const float hi) const {
+            BoundingBox clipped;
+            for (uint k = 0; k < 3; k++) {
+                const Vector<float> a = mesh.getVertex(ref.triangle, k);
+                const Vector<float> b = mesh.getVertex(ref.triangle, (k + 1) % 3);
+                if (a[axis] >= lo && a[axis] <= hi) clipped.growToInclude(a);
+                // Edge crossings with both slab planes
+                for (const float plane : {lo, hi}) {
+                    if ((a[axis] < plane) != (b[axis] < plane)) {
+                        clipped.growToInclude(a.lerp(b, (plane - a[axis]) / (b[axis] - a[axis])));
+                    }
+                }
+            }
+            return clipped.intersection(ref.bounds);
+        }
+
+        // Spatial binning : references are clipped into every bin they span, entries/exits count them once per side
+        __host__ std::tuple<uint, float, float> chooseSpatialSplit(const BoundingBox& nodeBounds, const std::vector<Reference>& refs) const {
+            const uint numBins = Utils::max(2u, Utils::min(params.numBins, maxBins));
+            SpatialBin bins[maxBins];
+            float rightCost[maxBins];
+            uint rightCounts[maxBins];
 
+            float bestSplitPos = 0;
+            uint bestSplitAxis = 0;
+            float bestCost = INFINITY;
+
+            for (uint axis = 0; axis < 3; axis++) {
+                const float lo = nodeBounds.getMin()[axis];
+                const float extent = nodeBounds.getMax()[axis] - lo;
+                if (extent <= 0) continue;
+
+                for (uint b = 0; b < numBins; b++) bins[b] = SpatialBin();
+
+                const float scale = numBins / extent;
+                for (const Reference& ref : refs) {
+                    const uint b0 = Utils::min(numBins - 1, (uint)Utils::max(0.f, (ref.bounds.getMin()[axis] - lo) * scale));
+                    const uint b1 = Utils::min(numBins - 1, (uint)Utils::max(0.f, (ref.bounds.getMax()[axis] - lo) * scale));
+                    for (uint b = b0; b <= b1; b++) {
+                        const BoundingBox clipped = b0 == b1 ? ref.bounds : clipTriangle(ref, axis, lo + b / scale, lo + (b + 1) / scale);
+                        bins[b].bounds.growToInclude(clipped.getMin(), clipped.getMax());
+                    }
+                    bins[b0].entries++;
+                    bins[b1].exits++;
+                }
+
+                BoundingBox rightBounds;
+                uint rightCount = 0;
+                for (uint b = numBins - 1; b > 0; b--) {
+                    rightBounds.growToInclude(bins[b].bounds.getMin(), bins[b].bounds.getMax());
+                    rightCount += bins[b].exits;
+                    rightCost[b - 1] = HalfArea(rightBounds) * leafTests(rightCount);
+                    rightCounts[b - 1] = rightCount;
+                }
+
+                BoundingBox leftBounds;
+                uint leftCount = 0;
+                for (uint b = 0; b < numBins - 1; b++) {
+                    leftBounds.growToInclude(bins[b].bounds.getMin(), bins[b].bounds.getMax());
+                    leftCount += bins[b].entries;
+                    if (leftCount == 0 || rightCounts[b] == 0) continue;
+
+                    const float cost = HalfArea(leftBounds) * leafTests(leftCount) + rightCost[b];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestSplitPos = lo + (b + 1) / scale;
+                        bestSplitAxis = axis;
+                    }
+                }
+            }
             return std::make_tuple(bestSplitAxis, bestSplitPos, bestCost);
         }
 
-        __host__ void split(const uint parentIndex, const uint triGlobalStart, const uint triNum, const uint depth = 0) {
-            const Vector<float> size = allNodes[parentIndex].getBoundingBox().getSize();
-            const float parentCost = NodeCost(size, triNum);
+        __host__ void makeSpatialLeaf(const uint nodeIndex, const std::vector<Reference>& refs) {
+            allNodes[nodeIndex].setTriangleIndex(triangleIndices.size());
+            allNodes[nodeIndex].setTriangleCount(refs.size());
+            for (const Reference& ref : refs) {
+                triangleIndices.push_back(ref.triangle);
+            }
+        }
+
+        // SBVH : best of an object split and a spatial split, the latter only when the object split children overlap
+        __host__ void splitSpatial(const uint nodeIndex, std::vector<Reference>& refs, const uint depth, const float rootArea) {
+            const uint count = refs.size();
+            const BoundingBox nodeBounds = allNodes[nodeIndex].getBoundingBox();
+            const float parentArea = HalfArea(nodeBounds);
+
+            std::tuple<uint, float, float> objectSplit = binnedSplit(count,
+                [&](const uint i) { return refs[i].bounds.getCenter(); },
+                [&](const uint i, BoundingBox& box) { box.growToInclude(refs[i].bounds.getMin(), refs[i].bounds.getMax()); });
+            const uint objectAxis = std::get<0>(objectSplit);
+            const float objectPos = std::get<1>(objectSplit);
+
+            bool spatial = false;
+            std::tuple<uint, float, float> best = objectSplit;
+            if (duplicationBudget > 0 && std::get<2>(objectSplit) < INFINITY) {
+                BoundingBox leftBounds, rightBounds;
+                for (const Reference& ref : refs) {
+                    BoundingBox& side = ref.bounds.getCenter()[objectAxis] < objectPos ? leftBounds : rightBounds;
+                    side.growToInclude(ref.bounds.getMin(), ref.bounds.getMax());
+                }
+                if (HalfArea(leftBounds.intersection(rightBounds)) > params.spatialSplitAlpha * rootArea) {
+                    std::tuple<uint, float, float> spatialSplit = chooseSpatialSplit(nodeBounds, refs);
+                    if (std::get<2>(spatialSplit) < std::get<2>(objectSplit)) {
+                        best = spatialSplit;
+                        spatial = true;
+                    }
+                }
+            }
+
+            const uint axis = std::get<0>(best);
+            const float pos = std::get<1>(best);
+            if (depth >= params.maxDepth || normalizeCost(std::get<2>(best), parentArea, count) >= params.intersectionCost * leafTests(count)) {
+                makeSpatialLeaf(nodeIndex, refs);
+                return;
+            }
 
-            std::tuple<uint, float, float> splitting = chooseSplit(allNodes[parentIndex], triGlobalStart, triNum);
+            std::vector<Reference> leftRefs, rightRefs;
+            for (const Reference& ref : refs) {
+                const bool straddles = ref.bounds.getMin()[axis] < pos && ref.bounds.getMax()[axis] > pos;
+                if (spatial && straddles && duplicationBudget > 0) {
+                    duplicationBudget--;
+                    leftRefs.push_back({clipTriangle(ref, axis, -INFINITY, pos), ref.triangle});
+                    rightRefs.push_back({clipTriangle(ref, axis, pos, INFINITY), ref.triangle});
+                } else if (spatial ? ref.bounds.getMax()[axis] <= pos || (straddles && ref.bounds.getCenter()[axis] < pos)
+                                   : ref.bounds.getCenter()[axis] < pos) {
+                    leftRefs.push_back(ref);
+                } else {
+                    rightRefs.push_back(ref);
+                }
+            }
+
+            if (leftRefs.empty() || rightRefs.empty()) {
+                makeSpatialLeaf(nodeIndex, refs);
+                return;
+            }
+
+            Node childA = Node();
+            Node childB = Node();
+            for (const Reference& ref : leftRefs) childA.addToBoundingBox(ref.bounds);
+            for (const Reference& ref : rightRefs) childB.addToBoundingBox(ref.bounds);
+            const uint childIndexLeft = allNodes.push_back(childA);
+            const uint childIndexRight = allNodes.push_back(childB);
+            allNodes[nodeIndex].setChildIndex(childIndexLeft);
+
+            std::vector<Reference>().swap(refs); // Release the parent list before going deeper
+            splitSpatial(childIndexLeft, leftRefs, depth + 1, rootArea);
+            splitSpatial(childIndexRight, rightRefs, depth + 1, rootArea);
+        }
+
+        // Lays out the top half of the levels below pair, then every subtree hanging under them
+        template <typename ChildPairs>
+        __host__ static void layoutVanEmdeBoas(const uint pair, const uint height, std::vector<uint>& order, ChildPairs childPairs) {
+            if (height <= 1) {
+                order.push_back(pair);
+                return;
+            }
+            const uint topHeight = (height + 1) / 2;
+            layoutVanEmdeBoas(pair, topHeight, order, childPairs);
+
+            // Pairs topHeight levels below, left to right
+            std::vector<uint> frontier = {pair};
+            for (uint level = 0; level < topHeight; level++) {
+                std::vector<uint> next;
+                for (const uint p : frontier) childPairs(p, next);
+                frontier.swap(next);
+            }
+            for (const uint p : frontier) {
+                layoutVanEmdeBoas(p, height - topHeight, order, childPairs);
+            }
+        }
+
+        // Spreads the 10 low bits of v so that two zero bits separate each of them
+        __host__ static uint ExpandBits(uint v) {
+            v = (v * 0x00010001u) & 0xFF0000FFu;
+            v = (v * 0x00000101u) & 0x0F00F00Fu;
+            v = (v * 0x00000011u) & 0xC30C30C3u;
+            v = (v * 0x00000005u) & 0x49249249u;
+            return v;
+        }
+
+        // 30 bits Morton code of a point inside bounds
+        __host__ static uint MortonCode(const Vector<float>& point, const BoundingBox& bounds) {
+            const Vector<float> size = bounds.getSize();
+            uint code = 0;
+            for (uint axis = 0; axis < 3; axis++) {
+                const float t = size[axis] > 0 ? (point[axis] - bounds.getMin()[axis]) / size[axis] : 0.f;
+                code |= ExpandBits(Utils::min(1023u, (uint)Utils::max(0.f, t * 1024.f))) << (2 - axis);
+            }
+            return code;
+        }
+
+        // LBVH : triangles sorted along a Morton curve, then every range split where its highest Morton bit flips
+        __host__ void buildLinear() {
+            const uint n = mesh.size();
+            BoundingBox centroidBounds;
+            for (uint i = 0; i < n; i++) {
+                centroidBounds.growToInclude(mesh.getBarycenter(i));
+            }
+
+            // Morton code in the high half, triangle in the low half, so that equal codes stay in triangle order
+            std::vector<uint64_t> keys(n);
+            #pragma omp parallel for
+            for (uint i = 0; i < n; i++) {
+                keys[i] = ((uint64_t)MortonCode(mesh.getBarycenter(i), centroidBounds) << 32) | i;
+            }
+            Utils::radixSort(keys, 32, 62);
+
+            for (uint i = 0; i < n; i++) {
+                triangleIndices.push_back((uint)keys[i]);
+            }
+            emitLinear(keys, 0, 0, n);
+            refitBounds();
+        }
+
+        __host__ void emitLinear(const std::vector<uint64_t>& keys, const uint nodeIndex, const uint start, const uint count) {
+            if (count <= Utils::max(1u, params.linearLeafSize)) {
+                allNodes[nodeIndex].setTriangleIndex(start);
+                allNodes[nodeIndex].setTriangleCount(count);
+                return;
+            }
+
+            // Last triangle sharing the highest differing bit of the range with the first one, halves when all codes are equal
+            const uint first = keys[start] >> 32;
+            const uint last = keys[start + count - 1] >> 32;
+            uint numOnLeft = count / 2;
+            if (first != last) {
+                const int prefix = __builtin_clz(first ^ last);
+                uint lo = 0, hi = count - 1;
+                while (hi - lo > 1) {
+                    const uint mid = (lo + hi) / 2;
+                    const uint x = first ^ (uint)(keys[start + mid] >> 32); // 0 when equal to the first, clz is undefined there
+                    if (x == 0 || __builtin_clz(x) > prefix) lo = mid;
+                    else hi = mid;
+                }
+                numOnLeft = hi;
+            }
+
+            const uint childIndexLeft = allNodes.push_back(Node());
+            allNodes.push_back(Node());
+            allNodes[nodeIndex].setChildIndex(childIndexLeft);
+            emitLinear(keys, childIndexLeft, start, numOnLeft);
+            emitLinear(keys, childIndexLeft + 1, start + numOnLeft, count - numOnLeft);
+        }
+
+        // nodes is the node list of the calling thread, nodes[0] being its subtree root
+        __host__ bool defers(const uint triNum) const {
+            return params.lazyBuild && triNum > params.lazyThreshold;
+        }
+
+        // expand : split this node even when a lazy build would defer it, see expand()
+        __host__ void split(std::vector<Node>& nodes, const uint parentIndex, const uint triGlobalStart, const uint triNum, const uint depth = 0, const bool expand = false) {
+            if (!expand && defers(triNum)) {
+                nodes[parentIndex].setPending(triGlobalStart, triNum);
+                return;
+            }
+            const float leafCost = params.intersectionCost * leafTests(triNum);
+
+            std::tuple<uint, float, float> splitting = chooseSplit(nodes[parentIndex], triGlobalStart, triNum);
             const uint splitAxis = std::get<0>(splitting);
             const float splitPos = std::get<1>(splitting);
             const float cost = std::get<2>(splitting);
             
-            if (depth < maxDepth && cost < parentCost) {
+            if (depth < params.maxDepth && cost < leafCost) {
                 Node childA = Node();
                 Node childB = Node();
 
                 uint numOnLeft = 0;
 
-                for (int i = triGlobalStart; i < triGlobalStart + triNum; i++) {
-                    const Triangle tri = allTriangles[i];
-                    if (tri.getBarycenter()[splitAxis] < splitPos) {
-                        childA.addToBoundingBox(tri);
+                for (uint i = triGlobalStart; i < triGlobalStart + triNum; i++) {
+                    const uint tri = triangleIndices[i];
+                    if (mesh.getBarycenter(tri)[splitAxis] < splitPos) {
+                        childA.addToBoundingBox(mesh.getMin(tri), mesh.getMax(tri));
 
-                        const Triangle swap = allTriangles[triGlobalStart + numOnLeft];
-                        allTriangles[triGlobalStart + numOnLeft] = tri;
-                        allTriangles[i] = swap;
+                        triangleIndices[i] = triangleIndices[triGlobalStart + numOnLeft];
+                        triangleIndices[triGlobalStart + numOnLeft] = tri;
                         numOnLeft++;
 
                     } else {
-                        childB.addToBoundingBox(tri);
+                        childB.addToBoundingBox(mesh.getMin(tri), mesh.getMax(tri));
                     }
                 }
 
-                const uint numOnRight = triNum - numOnLeft;
-                const uint triStartLeft = triGlobalStart + 0;
-                const uint triStartRight = triGlobalStart + numOnLeft;
-
-                childA.setTriangleIndex(triStartLeft);
-                childB.setTriangleIndex(triStartRight);
-                const uint childIndexLeft = allNodes.push_back(childA);
-                const uint childIndexRight = allNodes.push_back(childB);
+                // Bin boundaries and centroids can disagree by one ulp, never emit an empty child
+                if (numOnLeft == 0 || numOnLeft == triNum) {
+                    nodes[parentIndex].setTriangleIndex(triGlobalStart);
+                    nodes[parentIndex].setTriangleCount(triNum);
+                    return;
+                }
 
-                allNodes[parentIndex].setChildIndex(childIndexLeft);
+                const uint childIndexLeft = nodes.size();
+                nodes.push_back(childA);
+                nodes.push_back(childB);
+                nodes[parentIndex].setChildIndex(childIndexLeft);
 
-                split(childIndexLeft, triGlobalStart, numOnLeft, depth + 1);
-                split(childIndexRight, triGlobalStart + numOnLeft, numOnRight, depth + 1);
+                const uint childStart[2] = {triGlobalStart, triGlobalStart + numOnLeft};
+                const uint childCount[2] = {numOnLeft, triNum - numOnLeft};
+                // Large children are built by other threads into their own lists, the triangle ranges are disjoint
+                std::vector<Node> subtrees[2];
+                for (uint k = 0; k < 2; k++) {
+                    if (childCount[k] < params.parallelThreshold || defers(childCount[k])) continue;
+                    subtrees[k] = {nodes[childIndexLeft + k], Node(0u)};
+                    #pragma omp task default(shared) firstprivate(k)
+                    split(subtrees[k], 0, childStart[k], childCount[k], depth + 1);
+                }
+                for (uint k = 0; k < 2; k++) {
+                    if (childCount[k] < params.parallelThreshold || defers(childCount[k])) split(nodes, childIndexLeft + k, childStart[k], childCount[k], depth + 1);
+                }
+                #pragma omp taskwait
+                for (uint k = 0; k < 2; k++) {
+                    if (!subtrees[k].empty()) merge(nodes, childIndexLeft + k, subtrees[k]);
+                }
             } else {
-                allNodes[parentIndex].setTriangleIndex(triGlobalStart);
-                allNodes[parentIndex].setTriangleCount(triNum);
+                nodes[parentIndex].setTriangleIndex(triGlobalStart);
+                nodes[parentIndex].setTriangleCount(triNum);
             }
         }
 
+        // Appends a subtree built apart, its root replacing nodes[rootIndex] and its padding node dropped
+        __host__ static void merge(std::vector<Node>& nodes, const uint rootIndex, const std::vector<Node>& subtree) {
+            const uint offset = nodes.size() - 2;
+            auto relocate = [offset](Node node) {
+                if (!node.isLeaf()) node.setChildIndex(node.getChildIndex() + offset);
+                return node;
+            };
+            nodes[rootIndex] = relocate(subtree[0]);
+            for (uint i = 2; i < subtree.size(); i++) {
+                nodes.push_back(relocate(subtree[i]));
+            }
+        }
+
+        // Pending nodes below the root of nodes, with their depth
+        template <typename Nodes>
+        __host__ static void FindPending(const Nodes& nodes, const uint rootDepth, std::vector<std::pair<uint, uint>>& pending) {
+            std::vector<std::pair<uint, uint>> stack = {{0, rootDepth}};
+            while (!stack.empty()) {
+                const auto [index, depth] = stack.back();
+                stack.pop_back();
+                const Node& node = nodes[index];
+                if (node.isPending()) {
+                    pending.push_back({index, depth});
+                } else if (!node.isLeaf()) {
+                    stack.push_back({node.getChildIndex() + 0, depth + 1});
+                    stack.push_back({node.getChildIndex() + 1, depth + 1});
+                }
+            }
+        }
+
+        // Once laid out, since the layout moves pending nodes. Storage is reserved for the whole tree so that expansions never move nodes.
+        __host__ void prepareLazy() {
+            delete lazy;
+            lazy = nullptr;
+            std::vector<std::pair<uint, uint>> pending;
+            FindPending(allNodes, 0, pending);
+            if (pending.empty()) return;
+            lazy = new LazyBuild();
+            for (const auto& [index, depth] : pending) {
+                lazy->depths[index] = depth;
+            }
+            lazy->numNodes = allNodes.size();
+            allNodes.reserve(2*mesh.size() + 2); // Children are never empty, so at most 2n - 1 nodes plus the padding
+        }
+
+        // Expected cost of a random ray through the whole tree, relative to the root box
+        __host__ float computeSAHCost() const {
+            if (allNodes.size() == 0) return 0.f;
+            const float rootArea = HalfArea(allNodes[0].getBoundingBox());
+            if (rootArea <= 0) return params.intersectionCost * leafTests(size());
+
+            float cost = 0.f;
+            for (uint i = 0; i < allNodes.size(); i++) {
+                const Node& node = allNodes[i];
+                const float area = HalfArea(node.getBoundingBox()) / rootArea;
+                if (node.isLeaf())
+                    cost += area * params.intersectionCost * leafTests(node.getTriangleCount());
+                else
+                    cost += area * params.traversalCost;
+            }
+            return cost;
+        }
+
+        __host__ BVHParams getParams() const {
+            return params;
+        }
+
         __host__ void cuda() override {
+            expandAll(); // The device traversal cannot build
             allNodes.cuda();
-            allTriangles.cuda();
+            mesh.cuda();
+            triangleIndices.cuda();
+            allEdges.cuda();
         }
 
         __host__ void cpu() override {
             allNodes.cpu();
-            allTriangles.cpu();
+            mesh.cpu();
+            triangleIndices.cpu();
+            allEdges.cpu();
         }
 
         __host__ void sync_to_cpu() override {
             allNodes.sync_to_cpu();
-            allTriangles.sync_to_cpu();
+            mesh.sync_to_cpu();
+            triangleIndices.sync_to_cpu();
+            allEdges.sync_to_cpu();
         }
 
         __host__ void free() override {
             allNodes.free();
-            allTriangles.free();
+            mesh.freeDevice(); // Its host data belongs to the caller of the constructor, e.g. Environment::meshes
+            triangleIndices.free();
+            allEdges.free();
+            allBlocks.free();
+            leafBlocks.free();
+            delete lazy;
+            lazy = nullptr;
         }
 };
 
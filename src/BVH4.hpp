@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <stdexcept>
+
+#include "BVH.hpp"
+#include "utils/Array.hpp"
+
+/*
+4-wide node with the children's bounds stored as SoA, so that a single SSE slab test checks all of them.
+child[i] follows the Node encoding : LEAF_FLAG set means a triangle range of count[i] triangles.
+*/
+struct alignas(64) Node4 {
+    static constexpr uint WIDTH = 4;
+    static constexpr uint LEAF_FLAG = 0x80000000u;
+
+    float minX[WIDTH], minY[WIDTH], minZ[WIDTH];
+    float maxX[WIDTH], maxY[WIDTH], maxZ[WIDTH];
+    uint child[WIDTH];
+    uint count[WIDTH];
+    uint numChildren = 0;
+
+    __host__ void setChild(const uint i, const Node& node) {
+        minX[i] = node.getMin().getX(); minY[i] = node.getMin().getY(); minZ[i] = node.getMin().getZ();
+        maxX[i] = node.getMax().getX(); maxY[i] = node.getMax().getY(); maxZ[i] = node.getMax().getZ();
+        child[i] = node.isLeaf() ? (node.getTriangleIndex() | LEAF_FLAG) : 0;
+        count[i] = node.getTriangleCount();
+    }
+};
+
+/*
+Collapsed version of a binary BVH, for the CPU path only. Triangles are shared with the source BVH.
+*/
+class BVH4 {
+    private:
+        // Returns the index of the wide node covering the children of the binary node binaryIndex, level counting from 1 at the root
+        __host__ uint collapse(const BVH& bvh, const uint binaryIndex, const uint level) {
+            depth = Utils::max(depth, level);
+            std::vector<uint> children;
+            const Node& binaryNode = bvh.allNodes[binaryIndex];
+            if (binaryNode.isLeaf()) {
+                children.push_back(binaryIndex);
+            } else {
+                children.push_back(binaryNode.getChildIndex() + 0);
+                children.push_back(binaryNode.getChildIndex() + 1);
+            }
+
+            // Open the largest interior child until the node is full
+            while (children.size() < Node4::WIDTH) {
+                int largest = -1;
+                float largestArea = -1.f;
+                for (uint i = 0; i < children.size(); i++) {
+                    const Node& node = bvh.allNodes[children[i]];
+                    const float area = BVH::HalfArea(node.getBoundingBox());
+                    if (!node.isLeaf() && area > largestArea) {
+                        largest = i;
+                        largestArea = area;
+                    }
+                }
+                if (largest < 0) break;
+
+                const uint opened = bvh.allNodes[children[largest]].getChildIndex();
+                children[largest] = opened + 0;
+                children.push_back(opened + 1);
+            }
+
+            const uint wideIndex = allNodes.push_back(Node4());
+            for (uint i = 0; i < children.size(); i++) {
+                const Node& node = bvh.allNodes[children[i]];
+                allNodes[wideIndex].setChild(i, node);
+                allNodes[wideIndex].numChildren = i + 1;
+                if (!node.isLeaf()) {
+                    // Recursion may reallocate allNodes, so write the child index afterwards
+                    const uint childIndex = collapse(bvh, children[i], level + 1);
+                    allNodes[wideIndex].child[i] = childIndex;
+                }
+            }
+            return wideIndex;
+        }
+
+    public:
+        // Each wide node popped pushes up to WIDTH entries, so a traversal holds at most 3*depth + 1 of them.
+        // A wide level takes at least one binary level, MAX_DEPTH lets through any BVH that Ray::rayTriangleBVH can traverse
+        static constexpr uint MAX_DEPTH = BVH::STACK_SIZE - 1;
+        static constexpr uint STACK_SIZE = (Node4::WIDTH - 1)*MAX_DEPTH + 1;
+
+        Array<Node4> allNodes;
+        IndexedMesh mesh;
+        Array<uint> triangleIndices;
+        Array<TriangleEdges> allEdges;
+        uint depth = 0; // Levels of wide nodes
+
+        __host__ BVH4() {};
+        __host__ BVH4(const BVH& bvh) : mesh(bvh.mesh), triangleIndices(bvh.triangleIndices), allEdges(bvh.allEdges) {
+            if (bvh.allNodes.size() == 0) return;
+            bvh.expandAll();
+            collapse(bvh, 0, 1);
+            if (depth > MAX_DEPTH) throw std::length_error("BVH4 deeper than its traversal stack");
+        };
+
+        // Only the wide nodes are owned, the triangle data belongs to the source BVH
+        __host__ void free() {
+            allNodes.free();
+        }
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <functional>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "BVH.hpp"
+#include "utils/Hash.hpp"
+
+/*
+Binary cache of built BVHs, next to each model and named after the key, so that instances of a model or builds with other
+parameters get files of their own.
+Layout : Header, then allNodes, triangleIndices and allEdges as raw arrays. The file is mapped and copied as is,
+so it is only valid on the machine layout that wrote it (sizes are part of the key).
+*/
+class BVHCache {
+    private:
+        static constexpr uint32_t MAGIC = 0x43485642; // "BVHC"
+        static constexpr uint32_t VERSION = 1;
+
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t key;
+            uint32_t numNodes;
+            uint32_t numIndices;
+            uint32_t numEdges;
+            float builtSAHCost;
+        };
+
+        static size_t fileSize(const Header& header) {
+            return sizeof(Header) + header.numNodes * sizeof(Node) + header.numIndices * sizeof(uint) + header.numEdges * sizeof(TriangleEdges);
+        }
+
+    public:
+        // Mesh content, build parameters and binary layout
+        static uint64_t key(const IndexedMesh& mesh, const BVHParams& params) {
+            uint64_t key = mesh.hash();
+            key = Utils::hash(params.numBins, key);
+            key = Utils::hash(params.traversalCost, key);
+            key = Utils::hash(params.intersectionCost, key);
+            key = Utils::hash(params.blockWidth, key);
+            key = Utils::hash(params.maxDepth, key);
+            key = Utils::hash(params.spatialSplits, key);
+            key = Utils::hash(params.spatialSplitAlpha, key);
+            key = Utils::hash(params.maxDuplication, key);
+            key = Utils::hash(params.linearBuild, key);
+            key = Utils::hash(params.linearLeafSize, key);
+            key = Utils::hash(params.layout, key);
+            key = Utils::hash(sizeof(Node), key);
+            return Utils::hash(sizeof(TriangleEdges), key);
+        }
+
+        // <model>.<key>.bvh
+        static std::string pathFor(const std::string& modelPath, const IndexedMesh& mesh, const BVHParams& params) {
+            return modelPath + "." + Utils::hex(key(mesh, params)) + ".bvh";
+        }
+
+        // False if the file is missing, truncated or was written for another mesh or parameters
+        static bool load(const std::string& path, const IndexedMesh& mesh, const BVHParams& params, BVH& bvh) {
+#ifdef _WIN32
+            return false;
+#else
+            const int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+                close(fd);
+                return false;
+            }
+            void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapped == MAP_FAILED) return false;
+
+            const Header* header = static_cast<const Header*>(mapped);
+            const bool valid = header->magic == MAGIC && header->version == VERSION && header->key == key(mesh, params)
+                && fileSize(*header) == (size_t)st.st_size;
+            if (valid) {
+                const char* bytes = static_cast<const char*>(mapped) + sizeof(Header);
+                const Node* nodes = reinterpret_cast<const Node*>(bytes);
+                const uint* indices = reinterpret_cast<const uint*>(bytes + header->numNodes * sizeof(Node));
+                const TriangleEdges* edges = reinterpret_cast<const TriangleEdges*>(bytes + header->numNodes * sizeof(Node) + header->numIndices * sizeof(uint));
+                bvh = BVH(mesh, params, Array<Node>(nodes, header->numNodes), Array<uint>(indices, header->numIndices),
+                    Array<TriangleEdges>(edges, header->numEdges), header->builtSAHCost);
+            }
+            munmap(mapped, st.st_size);
+            return valid;
+#endif
+        }
+
+        // Written to a per thread temporary file first, so that a concurrent reader never sees half a cache
+        static bool save(const std::string& path, const BVH& bvh) {
+            bvh.expandAll(); // A cached tree is always loaded whole
+            const Header header = {MAGIC, VERSION, key(bvh.mesh, bvh.getParams()), bvh.allNodes.size(), bvh.triangleIndices.size(),
+                bvh.allEdges.size(), bvh.isLazy() ? bvh.computeSAHCost() : bvh.getBuiltSAHCost()};
+            const std::string tmpPath = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+            FILE* file = fopen(tmpPath.c_str(), "wb");
+            if (file == nullptr) return false;
+            bool ok = fwrite(&header, sizeof(Header), 1, file) == 1;
+            ok = ok && fwrite(bvh.allNodes.getCPUData(), sizeof(Node), header.numNodes, file) == header.numNodes;
+            ok = ok && fwrite(bvh.triangleIndices.getCPUData(), sizeof(uint), header.numIndices, file) == header.numIndices;
+            ok = ok && fwrite(bvh.allEdges.getCPUData(), sizeof(TriangleEdges), header.numEdges, file) == header.numEdges;
+            ok = fclose(file) == 0 && ok;
+            if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+                std::remove(tmpPath.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        // Cached tree when the key matches, otherwise a fresh build that refreshes the cache
+        static BVH loadOrBuild(const std::string& path, const IndexedMesh& mesh, const BVHParams& params, bool& hit) {
+            BVH bvh;
+            hit = load(path, mesh, params, bvh);
+            if (hit) return bvh;
+            bvh = BVH(mesh, params);
+            if (!save(path, bvh)) std::cerr << "Could not write BVH cache " << path << std::endl;
+            return bvh;
+        }
+};
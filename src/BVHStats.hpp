@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include "BVH.hpp"
+
+/*
+Shape and quality of a built BVH, walked from the root so that the padding node is left out.
+Depths count edges from the root, the root being at depth 0.
+*/
+struct BVHStats {
+    uint numNodes = 0;
+    uint numInteriors = 0;
+    uint numLeaves = 0;
+    uint numEmptyLeaves = 0;
+    uint numTriangles = 0;
+    uint numReferences = 0; // Above numTriangles when spatial splits duplicated triangles
+    uint maxDepth = 0;
+    float meanLeafDepth = 0.f;
+    float meanLeafSize = 0.f;
+    uint maxLeafSize = 0;
+    float sahCost = 0.f;
+    // Worst stack use of the closest hit traversal : one pending sibling per level, plus both children of the last interior node
+    uint maxStackDepth = 0;
+    uint stackSize = BVH::STACK_SIZE;
+    size_t nodeBytes = 0;
+    float meanPageJumps = 0.f; // Root to leaf links leaving a 4 KiB page, averaged over leaves : lower is a more cache friendly layout
+    std::vector<uint> leavesByDepth;
+    std::vector<uint> leavesBySize;
+
+    static BVHStats Compute(const BVH& bvh) {
+        BVHStats stats;
+        stats.numTriangles = bvh.mesh.size();
+        stats.numReferences = bvh.size();
+        stats.sahCost = bvh.computeSAHCost();
+        if (bvh.allNodes.size() == 0) return stats;
+
+        struct Entry {
+            uint index;
+            uint depth;
+            uint pageJumps;
+        };
+        std::vector<Entry> stack = {{0, 0, 0}};
+        size_t depthSum = 0;
+        constexpr uint nodesByPage = 4096 / sizeof(Node);
+        size_t pageJumpSum = 0;
+        while (!stack.empty()) {
+            const Entry entry = stack.back();
+            stack.pop_back();
+            const Node& node = bvh.allNodes[entry.index];
+            stats.numNodes++;
+            stats.maxDepth = Utils::max(stats.maxDepth, entry.depth);
+            if (node.isLeaf()) {
+                const uint count = node.getTriangleCount();
+                stats.numLeaves++;
+                stats.numEmptyLeaves += count == 0;
+                stats.maxLeafSize = Utils::max(stats.maxLeafSize, count);
+                depthSum += entry.depth;
+                pageJumpSum += entry.pageJumps;
+                if (stats.leavesByDepth.size() <= entry.depth) stats.leavesByDepth.resize(entry.depth + 1, 0);
+                if (stats.leavesBySize.size() <= count) stats.leavesBySize.resize(count + 1, 0);
+                stats.leavesByDepth[entry.depth]++;
+                stats.leavesBySize[count]++;
+            } else {
+                stats.numInteriors++;
+                const uint pageJumps = entry.pageJumps + (node.getChildIndex() / nodesByPage != entry.index / nodesByPage);
+                stack.push_back({node.getChildIndex() + 0, entry.depth + 1, pageJumps});
+                stack.push_back({node.getChildIndex() + 1, entry.depth + 1, pageJumps});
+            }
+        }
+        stats.meanLeafDepth = depthSum / (float)stats.numLeaves;
+        stats.meanLeafSize = stats.numReferences / (float)stats.numLeaves;
+        stats.meanPageJumps = pageJumpSum / (float)stats.numLeaves;
+        stats.maxStackDepth = stats.maxDepth + 1;
+        stats.nodeBytes = bvh.allNodes.size() * sizeof(Node);
+        return stats;
+    }
+
+    std::string toJSON() const {
+        auto list = [](const std::vector<uint>& values) {
+            std::ostringstream out;
+            out << "[";
+            for (uint i = 0; i < values.size(); i++) {
+                out << (i > 0 ? ", " : "") << values[i];
+            }
+            out << "]";
+            return out.str();
+        };
+        std::ostringstream out;
+        out << "{\"nodes\": " << numNodes << ", \"interiors\": " << numInteriors << ", \"leaves\": " << numLeaves
+            << ", \"emptyLeaves\": " << numEmptyLeaves << ", \"triangles\": " << numTriangles << ", \"references\": " << numReferences
+            << ", \"maxDepth\": " << maxDepth << ", \"meanLeafDepth\": " << meanLeafDepth
+            << ", \"meanLeafSize\": " << meanLeafSize << ", \"maxLeafSize\": " << maxLeafSize << ", \"sahCost\": " << sahCost
+            << ", \"maxStackDepth\": " << maxStackDepth << ", \"stackSize\": " << stackSize << ", \"nodeBytes\": " << nodeBytes
+            << ", \"meanPageJumps\": " << meanPageJumps
+            << ", \"leavesByDepth\": " << list(leavesByDepth) << ", \"leavesBySize\": " << list(leavesBySize) << "}";
+        return out.str();
+    }
+};
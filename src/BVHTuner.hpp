@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "BVH.hpp"
+#include "TLAS.hpp"
+#include "Ray.hpp"
+
+struct BVHTuning {
+    BVHParams params;
+    uint numCandidates = 0;
+    float defaultSteps = 0.f; // Nodes visited and triangles tested per ray with the base parameters
+    float bestSteps = 0.f; // Same with params
+    float defaultMs = 0.f; // Tracing the sample with the base parameters
+    float bestMs = 0.f; // Tracing the sample with params
+
+    float speedup() const {
+        return bestMs > 0 ? defaultMs / bestMs : 1.f;
+    }
+};
+
+/*
+Per mesh search of the build parameters : candidate trees are built and traced on a sample of rays, the one doing the least work wins.
+Work is counted rather than timed to pick the winner, since timings of identical trees can differ by 2x between allocations
+on the machines we bench on. Only the winner is then timed against the base tree, for the reported speedup.
+Only numBins, the SAH costs and spatialSplits are searched, the other fields come from the base parameters.
+The result is written next to the model, so that later runs build with it right away.
+*/
+class BVHTuner {
+    private:
+        static constexpr uint REPEATS = 5;
+        static constexpr float MIN_GAIN = 0.02f; // Smaller savings keep the base parameters
+
+    public:
+        static std::vector<BVHParams> Candidates(const BVHParams& base) {
+            std::vector<BVHParams> candidates;
+            for (const uint numBins : {8u, 16u, 32u}) {
+                for (const float intersectionCost : {0.5f, 1.f, 2.f}) {
+                    for (const bool spatialSplits : {false, true}) {
+                        BVHParams params = base;
+                        params.numBins = numBins;
+                        params.traversalCost = 1.f;
+                        params.intersectionCost = intersectionCost;
+                        params.spatialSplits = spatialSplits;
+                        params.linearBuild = false;
+                        params.lazyBuild = false;
+                        candidates.push_back(params);
+                    }
+                }
+            }
+            return candidates;
+        }
+
+        // Rays from a sphere around the mesh towards points of its box, when no camera rays are at hand
+        static std::vector<Ray> SampleRays(const IndexedMesh& mesh, const uint count, const uint seed = 1) {
+            BoundingBox bounds;
+            bounds.growToInclude(mesh);
+            const Vector<float> center = bounds.getCenter();
+            const float radius = Utils::max(bounds.getSize().norm(), 1E-3f);
+            std::mt19937 generator(seed);
+            std::uniform_real_distribution<float> uniform(0.f, 1.f);
+            std::normal_distribution<float> normal(0.f, 1.f);
+
+            std::vector<Ray> rays;
+            for (uint i = 0; i < count; i++) {
+                const Vector<float> onSphere = Vector<float>(normal(generator), normal(generator), normal(generator)).normalize();
+                const Vector<float> origin = center + onSphere*radius;
+                const Vector<float> target = bounds.getMin() + bounds.getSize().productTermByTerm(Vector<float>(uniform(generator), uniform(generator), uniform(generator)));
+                rays.push_back(Ray(origin, target - origin));
+            }
+            return rays;
+        }
+
+        // One run over the whole sample, in ms
+        static float TraceMs(const BVH& bvh, const std::vector<Ray>& rays) {
+            auto start = std::chrono::steady_clock::now();
+            for (const Ray& sample : rays) {
+                Ray ray = sample;
+                Hit hit = Hit();
+                ray.rayTriangleBVH(bvh, 0, 0, hit);
+            }
+            auto end = std::chrono::steady_clock::now();
+            std::chrono::duration<float, std::milli> elapsed = end - start;
+            return elapsed.count();
+        }
+
+        // Traversal steps per ray, through a one BVH TLAS whose single node adds the same step to every candidate
+        static float StepsPerRay(const BVH& bvh, const std::vector<Ray>& rays) {
+            Array<BVH> bvhs = Array<BVH>();
+            bvhs.push_back(bvh);
+            TLAS tlas = TLAS(bvhs);
+            size_t steps = 0;
+            for (const Ray& ray : rays) {
+                const TraversalStats stats = ray.traversalSteps(tlas, bvhs);
+                steps += stats.nodes + stats.triangles;
+            }
+            tlas.free();
+            bvhs[0] = BVH(); // Only the array is freed, the BVH belongs to the caller
+            bvhs.free();
+            return steps / Utils::max(1.f, (float)rays.size());
+        }
+
+        static BVHTuning Tune(const IndexedMesh& mesh, const std::vector<Ray>& rays, const BVHParams& base = BVHParams()) {
+            BVHTuning tuning;
+            tuning.params = base;
+            tuning.params.lazyBuild = false; // Expansions would be counted with the first rays
+            const BVHParams referenceParams = tuning.params;
+            BVH reference = BVH(mesh, referenceParams);
+            tuning.defaultSteps = StepsPerRay(reference, rays);
+            tuning.bestSteps = tuning.defaultSteps;
+
+            for (const BVHParams& params : Candidates(base)) {
+                BVH bvh = BVH(mesh, params);
+                const float steps = StepsPerRay(bvh, rays);
+                bvh.free();
+                tuning.numCandidates++;
+                if (steps < tuning.bestSteps * (1.f - MIN_GAIN)) {
+                    tuning.bestSteps = steps;
+                    tuning.params = params;
+                }
+            }
+
+            // Runs of both trees alternate, so that a slower or warming up machine affects both sides
+            BVH best = BVH(mesh, tuning.params);
+            tuning.defaultMs = INFINITY;
+            tuning.bestMs = INFINITY;
+            for (uint repeat = 0; repeat < REPEATS; repeat++) {
+                tuning.defaultMs = Utils::min(tuning.defaultMs, TraceMs(reference, rays));
+                tuning.bestMs = Utils::min(tuning.bestMs, TraceMs(best, rays));
+            }
+            reference.free();
+            best.free();
+
+            tuning.params.lazyBuild = base.lazyBuild;
+            return tuning;
+        }
+
+        // One file per mesh content, so that two instances of a model placed or scaled differently keep their own
+        static std::string pathFor(const std::string& modelPath, const IndexedMesh& mesh) {
+            return modelPath + "." + Utils::hex(mesh.hash()) + ".tune";
+        }
+
+        static bool save(const std::string& path, const IndexedMesh& mesh, const BVHParams& params) {
+            std::ofstream file(path);
+            if (!file) return false;
+            file << "hash " << mesh.hash() << "\n";
+            file << "numBins " << params.numBins << "\n";
+            file << "traversalCost " << params.traversalCost << "\n";
+            file << "intersectionCost " << params.intersectionCost << "\n";
+            file << "spatialSplits " << params.spatialSplits << "\n";
+            return (bool)file;
+        }
+
+        // Tuned fields over params, only if the file was written for this very mesh
+        static bool load(const std::string& path, const IndexedMesh& mesh, BVHParams& params) {
+            std::ifstream file(path);
+            if (!file) return false;
+            BVHParams tuned = params;
+            uint64_t hash = 0;
+            std::string name;
+            while (file >> name) {
+                if (name == "hash") file >> hash;
+                else if (name == "numBins") file >> tuned.numBins;
+                else if (name == "traversalCost") file >> tuned.traversalCost;
+                else if (name == "intersectionCost") file >> tuned.intersectionCost;
+                else if (name == "spatialSplits") file >> tuned.spatialSplits;
+                else return false;
+            }
+            if (hash != mesh.hash()) return false;
+            params = tuned;
+            return true;
+        }
+};
@@ -10,7 +10,7 @@
 #include <fstream>
 #include <png.h>
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
 
 #define ROT_RIGHT 2000
 #define ROT_FRONT 2001
@@ -50,7 +50,7 @@ class Camera : public CudaReady {
             capteurWidth = (0.005*width0)/(1.*height0);
             capteurHeight = 0.005;
         };
-        __host__ Camera(Vector<float> pos, Vector<float> front, uint width0, uint height0) : position(pos), vectFront(front.normalize()), vectUp(Vector<float>(0,0,1)), vectRight(front.crossProduct(Vector<float>(0,0,1)).normalize()), width(width0), height(height0), pixels(width0*height0*threadsByRay) {
+        __host__ Camera(Vector<float> pos, Vector<float> front, uint width0, uint height0) : position(pos), vectFront(front.normalize()), vectUp(Vector<float>(0,0,1)), vectRight(front.crossProduct(Vector<float>(0,0,1)).normalize()), width(width0), height(height0), pixels(width0*height0) {
             capteurWidth = (0.005*width0)/(1.*height0);
             capteurHeight = 0.005;
         };
@@ -192,7 +192,8 @@ class Camera : public CudaReady {
             vectUp=(R*vectUp).normalize();
         }
 
-        __host__ __device__ Ray generate_ray(const uint w, const uint h) const {
+        // Fractional coordinates move the ray inside the pixel, integers are its center
+        __host__ __device__ Ray generate_ray(const float w, const float h) const {
             return Ray(position, (vectFront*fov+getPixelCoordOnCapt(w,h)).normalize());
         }
 
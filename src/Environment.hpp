@@ -12,38 +12,69 @@
 #include "shaders/Convolve.hpp"
 
 #include "Tracing.hpp"
+#include "BVHCache.hpp"
+#include "BVHTuner.hpp"
+#include "RayPacket.hpp"
+#include "Wavefront.hpp"
 
 #include "Image.hpp"
 #include "Obj.hpp"
 #include "Mesh.hpp"
 #include "utils/ProgressBar.hpp"
+#include "utils/ThreadPool.hpp"
+#include "utils/Sampler.hpp"
 
 #include <stdlib.h>
 #include <time.h>
 #include "omp.h"
 #include <chrono>
+#include <map>
+#include <memory>
+#include <atomic>
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
 
 #define cudaErrorCheck(call){cudaAssert(call,__FILE__,__LINE__);}
 
 enum Mode {
     SIMPLE_RENDER,
     RAYTRACING,
-    BVH_RAYTRACING
+    BVH_RAYTRACING,
+    WAVEFRONT_RAYTRACING // Same paths as BVH_RAYTRACING, traced by stages over a queue, see Wavefront
 };
 
 class Environment {
     private:
         Camera* cam;
-        Meshes meshes;
-        uint samples = 5;
+        Array<IndexedMesh> meshes;
+        std::map<uint, std::string> modelPaths; // Model file of the meshes loaded with addObj, their BVH cache and tuning sit next to it
+        std::map<uint, BVHParams> meshParams; // Tuned by autotune_bvhs during this run
+        uint samples = 1; // Per pixel of the CPU render
+        Sampler sampler = Sampler(SOBOL_SAMPLER);
 
         uint samplesByThread = 2;
 
         Pixel backgroundColor = Pixel(0,0,0);
         Mode mode = BVH_RAYTRACING;
         Array<BVH> BVHs = Array<BVH>();
+        BVHParams bvhParams;
+        TLAS tlas = TLAS();
+        bool bvhsOnDevice = false;
+        uint numThreads = std::thread::hardware_concurrency(); // Of the CPU render
+        uint frame = 0; // Random seed of the next renderCudaBVH, two runs draw the same numbers
+        std::unique_ptr<ThreadPool> pool;
+
+        bool usesBVHs() const {
+            return mode==BVH_RAYTRACING || mode==WAVEFRONT_RAYTRACING;
+        }
+
+        // Bring the BVHs back on the host before touching the meshes they share
+        void syncBVHsToHost() {
+            if (!bvhsOnDevice) return;
+            BVHs.cpu();
+            tlas.cpu();
+            bvhsOnDevice = false;
+        }
 
     public:
         Environment() {
@@ -56,10 +87,15 @@ class Environment {
             cam = cam0;
         };
         ~Environment() {
-            if (mode==BVH_RAYTRACING) {
+            sampler.cpu();
+            sampler.free();
+            if (usesBVHs()) {
                 BVHs.cpu();
                 BVHs.free();
+                tlas.cpu();
+                tlas.free();
             }
+            meshes.free(); // After the BVHs, which only share them
         };
 
         void addBackground(const Pixel& color) {
@@ -71,34 +107,168 @@ class Environment {
 
         void compute_bvhs() {
             auto start = std::chrono::steady_clock::now();
+            float sahCost = 0.f;
+            size_t nodeBytes = 0;
+            size_t meshBytes = 0;
+            size_t edgeBytes = 0;
+            uint nbTriangles = 0;
+            uint nbCached = 0;
+            // One task per mesh, large subtrees inside each BVH become tasks of the same team
+            std::vector<BVH> meshBVHs(meshes.size());
+            std::vector<char> cached(meshes.size(), false);
+            #pragma omp parallel
+            #pragma omp single
             for (uint i=0; i<meshes.size(); i++) {
-                BVHs.push_back(BVH(meshes[i]));
+                #pragma omp task default(shared) firstprivate(i)
+                {
+                    // A lazy BVH is not cached, saving it would build it whole
+                    const BVHParams params = paramsFor(i);
+                    auto modelPath = modelPaths.find(i);
+                    if (modelPath != modelPaths.end() && !params.lazyBuild) {
+                        bool hit = false;
+                        meshBVHs[i] = BVHCache::loadOrBuild(BVHCache::pathFor(modelPath->second, meshes[i], params), meshes[i], params, hit);
+                        cached[i] = hit;
+                    } else {
+                        meshBVHs[i] = BVH(meshes[i], params);
+                    }
+                }
             }
+            for (uint i=0; i<meshes.size(); i++) {
+                BVHs.push_back(meshBVHs[i]);
+                nbCached += cached[i];
+                sahCost += BVHs[-1].computeSAHCost();
+                nodeBytes += BVHs[-1].allNodes.size() * sizeof(Node);
+                meshBytes += meshes[i].bytes() + BVHs[-1].triangleIndices.size() * sizeof(uint);
+                edgeBytes += BVHs[-1].allEdges.size() * sizeof(TriangleEdges);
+                nbTriangles += meshes[i].size();
+            }
+            tlas = TLAS(BVHs);
+            auto built = std::chrono::steady_clock::now();
             BVHs.cuda();
+            tlas.cuda();
+            bvhsOnDevice = true;
             auto end = std::chrono::steady_clock::now();
+            std::chrono::duration<float> build_seconds = built-start;
             std::chrono::duration<float> elapsed_seconds = end-start;
+            std::cout << "BVHs built:\t\t" << build_seconds.count() << "s (SAH cost " << sahCost << ", " << nodeBytes/1024. << " KiB of nodes, "
+                << nbCached << "/" << modelPaths.size() << " from cache)\n";
             std::cout << "BVHs on device:\t\t" << elapsed_seconds.count() << "s\n";
+            if (nbTriangles > 0) {
+                std::cout << "Bytes per triangle:\t" << meshBytes/(1.*nbTriangles) << " indexed + " << edgeBytes/(1.*nbTriangles)
+                    << " edges (" << sizeof(Triangle) << " as Triangle)\n";
+            }
+        }
+
+        // Translate one mesh, the BVHs are only updated by the next refit_bvhs()
+        void moveMesh(const uint meshIndex, const Vector<float>& offset) {
+            syncBVHsToHost();
+            meshes[meshIndex].move(offset);
+        }
+
+        // Refit the BVHs after their meshes moved, rebuilding the ones whose SAH cost degraded too much
+        void refit_bvhs() {
+            auto start = std::chrono::steady_clock::now();
+            syncBVHsToHost();
+            float sahCost = 0.f;
+            uint rebuilt = 0;
+            for (uint i=0; i<BVHs.size(); i++) {
+                if (BVHs[i].update()) rebuilt++;
+                sahCost += BVHs[i].computeSAHCost();
+            }
+            tlas.free();
+            tlas = TLAS(BVHs);
+            BVHs.cuda();
+            tlas.cuda();
+            bvhsOnDevice = true;
+            auto end = std::chrono::steady_clock::now();
+            std::chrono::duration<float> elapsed_seconds = end-start;
+            std::cout << "BVHs refitted:\t\t" << elapsed_seconds.count() << "s (SAH cost " << sahCost << ", " << rebuilt << "/" << BVHs.size() << " rebuilt)\n";
         }
 
         void setMode(const Mode m) {
             mode = m;
         }
 
-        void addTriangle(Triangle& triangle) {
-            meshes.push_back(Mesh(triangle));
+        void setNumThreads(const uint n) {
+            numThreads = n > 0 ? n : 1;
         }
 
-        void addSquare(Vector<float> v1, Vector<float> v2, Vector<float> v3, Vector<float> v4, Material mat) {
-            Triangle triangle = Triangle(v1,mat);
-            triangle.setvertex(1, v2);
-            triangle.setvertex(2, v4);
+        // Any count, the samplers place as many samples as evenly as they can
+        void setSamples(const uint n) {
+            samples = n > 0 ? n : 1;
+        }
 
-            Triangle triangleBis = Triangle(v2,mat);
-            triangleBis.setvertex(1, v3);
-            triangleBis.setvertex(2, v4);
+        void setSampler(const SamplerType type, const uint seed = 0) {
+            sampler.cpu();
+            sampler.free();
+            sampler = Sampler(type, cam->getWidth(), seed);
+        }
+
+        // Used by the next compute_bvhs()
+        void setBVHParams(const BVHParams& params) {
+            bvhParams = params;
+        }
+
+        // Tuned during this run, else tuned by an earlier run and recorded next to the model, else the scene parameters
+        BVHParams paramsFor(const uint meshIndex) const {
+            auto tuned = meshParams.find(meshIndex);
+            if (tuned != meshParams.end()) return tuned->second;
+            BVHParams params = bvhParams;
+            auto modelPath = modelPaths.find(meshIndex);
+            if (modelPath != modelPaths.end()) BVHTuner::load(BVHTuner::pathFor(modelPath->second, meshes[meshIndex]), meshes[meshIndex], params);
+            return params;
+        }
+
+        // Times candidate builds of every mesh on the camera rays reaching it, the fastest parameters are used by compute_bvhs from then on
+        void autotune_bvhs(const uint stride = 8) {
+            auto start = std::chrono::steady_clock::now();
+            for (uint i=0; i<meshes.size(); i++) {
+                BoundingBox bounds;
+                bounds.growToInclude(meshes[i]);
+                std::vector<Ray> rays;
+                if (cam != nullptr) {
+                    for (uint h = 0; h < cam->getHeight() - stride + 1; h += stride) {
+                        for (uint w = 0; w < cam->getWidth() - stride + 1; w += stride) {
+                            Ray ray = cam->generate_ray(w, h);
+                            if (ray.distToBounds(bounds) < INFINITY) rays.push_back(ray);
+                        }
+                    }
+                }
+                // Meshes the camera barely sees are tuned on rays from all around them
+                if (rays.size() < 1024) {
+                    const std::vector<Ray> sample = BVHTuner::SampleRays(meshes[i], 4096);
+                    rays.insert(rays.end(), sample.begin(), sample.end());
+                }
+
+                const BVHTuning tuning = BVHTuner::Tune(meshes[i], rays, bvhParams);
+                meshParams[i] = tuning.params;
+                auto modelPath = modelPaths.find(i);
+                if (modelPath != modelPaths.end() && !BVHTuner::save(BVHTuner::pathFor(modelPath->second, meshes[i]), meshes[i], tuning.params)) {
+                    std::cerr << "Could not write BVH tuning " << BVHTuner::pathFor(modelPath->second, meshes[i]) << std::endl;
+                }
+                std::cout << "Mesh " << i << " (" << meshes[i].size() << " triangles, " << rays.size() << " rays):\t" << tuning.defaultSteps << " -> "
+                    << tuning.bestSteps << " steps per ray over " << tuning.numCandidates << " candidates, " << tuning.defaultMs << " -> " << tuning.bestMs
+                    << " ms, x" << tuning.speedup() << " (" << tuning.params.numBins << " bins, intersection cost " << tuning.params.intersectionCost
+                    << (tuning.params.spatialSplits ? ", spatial splits" : "") << ")\n";
+            }
+            auto end = std::chrono::steady_clock::now();
+            std::chrono::duration<float> elapsed_seconds = end-start;
+            std::cout << "BVHs tuned:\t\t" << elapsed_seconds.count() << "s\n";
+        }
+
+        void addTriangle(Triangle& triangle) {
+            meshes.push_back(IndexedMesh(Mesh(triangle)));
+        }
 
-            Mesh mesh = Mesh(triangle);
-            mesh.push_back(triangleBis);
+        void addSquare(Vector<float> v1, Vector<float> v2, Vector<float> v3, Vector<float> v4, Material mat) {
+            IndexedMesh mesh = IndexedMesh();
+            const uint16_t materialId = mesh.addMaterial(mat);
+            const uint i1 = mesh.addVertex(v1);
+            const uint i2 = mesh.addVertex(v2);
+            const uint i3 = mesh.addVertex(v3);
+            const uint i4 = mesh.addVertex(v4);
+            mesh.addTriangle(i1, i2, i4, materialId);
+            mesh.addTriangle(i2, i3, i4, materialId);
             meshes.push_back(mesh);
         }
 
@@ -111,150 +281,315 @@ class Environment {
             Obj obj = Obj(name);
             //obj.print();
 
-            std::vector<Vector<float>> vertices = obj.getVertices();
-            std::vector<Vector<float>> normal_vertices = obj.getNormalVertices();
-            std::vector<std::vector<Vector<int>>> indexes = obj.getIndexes();
-
-            float angle = 3.14159/2.0;
-            float ux = 1;
-            float uy = 0;
-            float uz = 0;
-            Matrix<float> P = Matrix<float>(ux*ux,ux*uy,ux*uz,ux*uy,uy*uy,uy*uz,ux*uz,uy*uz,uz*uz);
-            Matrix<float> I = Matrix<float>(1.,MATRIX_EYE);
-            Matrix<float> Q = Matrix<float>(0,-uz,uy,uz,0,-ux,-uy,ux,0);
-
-            Matrix<float> R = P + (I-P)*std::cos(angle) + Q*std::sin(angle);
-
-            /*
-            The OBJ format can provide multiple vertices for one triangle. We have to convert it in triangles as follow.
-            */
-            Mesh mesh = Mesh();
-            for (uint i=0;i<indexes.size();i++) {
-                std::vector<Vector<int>> fi = indexes[i];
-
-                for (uint v=2;v<fi.size();v++) {
-                    Triangle triangle = Triangle(mat);
-                    if (v==2) {
-                        for (uint j = 0; j<3; j++) { 
-                            triangle.setvertex(j, R*vertices[fi[j].getX()]*scale + offset );
-                            triangle.setNormal(j, R*normal_vertices[fi[j].getZ()] );
-                        }
-                    } else {
-                        triangle.setvertex(0, R*vertices[fi[v-3].getX()]*scale + offset );
-                        triangle.setvertex(1, R*vertices[fi[v-1].getX()]*scale + offset );
-                        triangle.setvertex(2, R*vertices[fi[v  ].getX()]*scale + offset );
-
-                        triangle.setNormal(0, R*normal_vertices[fi[v-3].getZ()] );
-                        triangle.setNormal(1, R*normal_vertices[fi[v-1].getZ()] );
-                        triangle.setNormal(2, R*normal_vertices[fi[v  ].getZ()] );
-                    }
-                    mesh.push_back(triangle);
-                    obj.nbTriangles += 1;
-                }
-            }
+            IndexedMesh mesh = obj.toMesh(offset, scale, mat);
+            modelPaths[meshes.size()] = obj.getPath();
             meshes.push_back(mesh);
             std::cout << name.c_str() << " loaded with " << obj.nbTriangles << " triangles and " << obj.failedTriangles << " wrong ones." << std::endl;
         }        
 
+        // One pixel of the CPU render, its samples averaged
+        Pixel renderPixel(const uint w, const uint h, const TLAS& tlas, const Array<BVH>& bvhs) const {
+            const uint idx = h*cam->getWidth()+w;
+            if (mode==SIMPLE_RENDER) {
+                Vector<float> direction = (cam->getVectFront()*cam->getFov()+cam->getPixelCoordOnCapt(w,h)).normalize();
+                Ray ray = Ray(cam->getPosition(),direction);
+                return Tracing::simpleRayTraceHost(ray, meshes, backgroundColor);
+            }
+
+            Vector<float> colorVec;
+            for (uint s = 0; s < samples; s++) {
+                float dx, dy;
+                sampler.pixelOffset(idx, s, dx, dy);
+                Ray ray = cam->generate_ray(w + dx, h + dy);
+                if (mode==RAYTRACING)
+                    colorVec += Tracing::rayTraceHost(ray, meshes, sampler, idx, s).toVector();
+                else
+                    colorVec += Tracing::rayTraceBVHHost(ray, tlas, bvhs, sampler, idx, s).toVector();
+            }
+            return Pixel(colorVec/samples);
+        }
+
+        // Offline CPU render : tiles of TILE_SIZE*TILE_SIZE pixels spread over the thread pool, see ThreadPool for the scheduling
         void render() {
+            static constexpr uint TILE_SIZE = 16;
             const uint H = cam->getHeight();
             const uint W = cam->getWidth();
 
             Array<BVH> BVHs = Array<BVH>();
-            if (mode==BVH_RAYTRACING) {
+            TLAS tlas = TLAS();
+            if (usesBVHs()) {
                 for (uint i=0; i<meshes.size(); i++) {
                     std::cout << "BVH " << i << std::endl;
-                    BVHs.push_back(BVH(meshes[i]));
+                    BVHs.push_back(BVH(meshes[i], paramsFor(i)));
                 }
+                tlas = TLAS(BVHs);
                 std::cout << "BVHs done" << std::endl;
             }
 
-            //#pragma omp parallel for num_threads(omp_get_num_devices())
-            for(uint h = 0; h < H; ++h) {
-                //#pragma omp parallel for num_threads(omp_get_num_devices())
-                for(uint w = 0; w < W; ++w) {
-                    printProgress((h*W+(w+1))/(1.*H*W));
+            sampler.cpu(); // Left on the device by renderCudaBVH
+            if (pool == nullptr || pool->size() != numThreads) pool = std::make_unique<ThreadPool>(numThreads);
+            // Per worker counters, a cache line each so that workers never write to the same line
+            struct alignas(64) Scratch {
+                size_t pixels = 0;
+                Wavefront wavefront;
+            };
+            std::vector<Scratch> scratch(pool->size());
+            const uint tilesX = (W + TILE_SIZE - 1)/TILE_SIZE;
+            const uint tilesY = (H + TILE_SIZE - 1)/TILE_SIZE;
+            const uint numTiles = tilesX*tilesY;
+            std::atomic<uint> tilesDone = 0;
+            const uint stolenBefore = pool->getNumStolen();
 
-                    uint idx = h*W+w;
+            auto start = std::chrono::steady_clock::now();
+            pool->run(numTiles, [&](const uint tile, const uint worker) {
+                const uint x0 = (tile % tilesX)*TILE_SIZE;
+                const uint y0 = (tile / tilesX)*TILE_SIZE;
+                const uint tileW = Utils::min(x0 + TILE_SIZE, W) - x0;
+                const uint tileH = Utils::min(y0 + TILE_SIZE, H) - y0;
+                Wavefront& wavefront = scratch[worker].wavefront;
+                if (mode==WAVEFRONT_RAYTRACING) wavefront.render(*cam, x0, y0, tileW, tileH, samples, sampler, tlas, BVHs);
+                for (uint y = 0; y < tileH; y++) {
+                    for (uint x = 0; x < tileW; x++) {
+                        const Pixel color = mode==WAVEFRONT_RAYTRACING ? wavefront.getPixel(x, y, tileW) : renderPixel(x0+x, y0+y, tlas, BVHs);
+                        cam->setPixel((y0+y)*W + x0+x, color);
+                        scratch[worker].pixels++;
+                    }
+                }
+                const uint done = ++tilesDone;
+                if (worker == 0) printProgress(done/(1.*numTiles)); // Only the calling thread writes to the console
+            });
+            printProgress(1.);
+            auto end = std::chrono::steady_clock::now();
+            std::chrono::duration<float> elapsed_seconds = end-start;
 
-                    Pixel color;
-                    Vector<float> colorVec;
-                    
-                    if (mode==SIMPLE_RENDER) {
-                        Vector<float> direction = (cam->getVectFront()*cam->getFov()+cam->getPixelCoordOnCapt(w,h)).normalize();
-                        Ray ray = Ray(cam->getPosition(),direction);
+            size_t minPixels = H*W, maxPixels = 0;
+            for (const Scratch& worker : scratch) {
+                minPixels = Utils::min(minPixels, worker.pixels);
+                maxPixels = Utils::max(maxPixels, worker.pixels);
+            }
+            std::cout << "CPU render:\t\t" << elapsed_seconds.count() << "s on " << pool->size() << " threads (" << numTiles << " tiles, "
+                << pool->getNumStolen() - stolenBefore << " stolen, " << minPixels << " to " << maxPixels << " pixels per thread)\n";
 
-                        color = Tracing::simpleRayTraceHost(ray, meshes, backgroundColor);
-                    }
+            if (usesBVHs()) {
+                BVHs.free();
+                tlas.free();
+            }
+        }
 
-                    else if (mode==RAYTRACING) {
-                        Vector<float> vectTmp;
-                        samples = 4; // has to be a perfect square
-                        int samplesSqrt=(int)std::sqrt(samples);
-                        
-                        float dy=-(samplesSqrt-1)/2.;
-                        do {
-                            float dx=-(samplesSqrt-1)/2.;
-                            do {
-                                Vector<float> direction = (cam->getVectFront()*cam->getFov()+cam->getPixelCoordOnCapt(w+dx/(1.*samplesSqrt),h+dy/(1.*samplesSqrt))).normalize();
-                                Ray ray = Ray(cam->getPosition(),direction);
-                                
-                                vectTmp = (Tracing::rayTraceHost(ray, meshes, idx)).toVector();
-
-                                colorVec += vectTmp;
-                                dx++;
-                            } while (dx<(samplesSqrt-1)/2);
-                            dy++;
-                        } while (dy<(samplesSqrt-1)/2.);
-                        colorVec/=(samples/2);
-                        color=Pixel(colorVec);
-                    }
+        // Primary rays traced on the CPU through each traversal path, to compare them on the same scene
+        void benchmarkHost(const uint stride = 4) {
+            auto buildBVHs = [&](const char* name, const BVHParams& params) {
+                Array<BVH> bvhs = Array<BVH>();
+                auto start = std::chrono::steady_clock::now();
+                for (uint i=0; i<meshes.size(); i++) {
+                    bvhs.push_back(BVH(meshes[i], params));
+                }
+                auto end = std::chrono::steady_clock::now();
+                std::chrono::duration<float, std::milli> elapsed = end-start;
+                std::cout << name << " build:\t" << elapsed.count() << " ms\n";
+                return bvhs;
+            };
+            Array<BVH> hostBVHs = buildBVHs("SAH ", BVHParams());
+            TLAS hostTLAS = TLAS(hostBVHs);
+            Array<BVH4> hostBVH4s = Array<BVH4>();
+            for (uint i=0; i<hostBVHs.size(); i++) {
+                hostBVH4s.push_back(BVH4(hostBVHs[i]));
+            }
 
-                    else if (mode==BVH_RAYTRACING) {
-                        Vector<float> vectTmp;
-                        samples = 1; // has to be a perfect square
-                        int samplesSqrt=(int)std::sqrt(samples);
-                        
-                        float dy=-(samplesSqrt-1)/2.;
-                        do {
-                            float dx=-(samplesSqrt-1)/2.;
-                            do {
-                                Vector<float> direction = (cam->getVectFront()*cam->getFov()+cam->getPixelCoordOnCapt(w+dx/(1.*samplesSqrt),h+dy/(1.*samplesSqrt))).normalize();
-                                Ray ray = Ray(cam->getPosition(),direction);
-
-                                vectTmp = (Tracing::rayTraceBVHHost(ray, BVHs, idx)).toVector();
-
-                                colorVec += vectTmp;
-                                dx++;
-                            } while (dx<(samplesSqrt-1)/2);
-                            dy++;
-                        } while (dy<(samplesSqrt-1)/2.);
-                        colorVec/=(samples/2);
-                        color=Pixel(colorVec);
+            const uint H = cam->getHeight();
+            const uint W = cam->getWidth();
+            const uint nbRays = (H/stride) * (W/stride);
+
+            auto bench = [&](const char* name, auto trace) {
+                uint nbHits = 0;
+                auto start = std::chrono::steady_clock::now();
+                for (uint h = 0; h < H - stride + 1; h += stride) {
+                    for (uint w = 0; w < W - stride + 1; w += stride) {
+                        Ray ray = cam->generate_ray(w, h);
+                        nbHits += trace(ray);
+                    }
+                }
+                auto end = std::chrono::steady_clock::now();
+                std::chrono::duration<float> elapsed_seconds = end-start;
+                std::cout << name << ":\t" << nbRays/elapsed_seconds.count()/1e6 << " Mrays/s (" << nbHits << " hits)\n";
+            };
+
+            auto closestHit = [](auto&&... args) {
+                Hit hit = Hit();
+                Tracing::rayTriangleBVHs(args..., hit);
+                return hit.getHasHit();
+            };
+            bench("BVH list", [&](Ray& ray) { return closestHit(ray, hostBVHs); });
+            bench("TLAS    ", [&](Ray& ray) { return closestHit(ray, hostTLAS, hostBVHs); });
+            bench("BVH4 list", [&](Ray& ray) { return closestHit(ray, hostBVH4s); });
+
+            // Leaves sized for the TriangleBlocks they are tested by
+            BVHParams blockParams;
+            blockParams.blockWidth = TriangleBlock::WIDTH;
+            Array<BVH> blockBVHs = buildBVHs("SAH blocks", blockParams);
+            TLAS blockTLAS = TLAS(blockBVHs);
+            bench("Blocks TLAS", [&](Ray& ray) { return closestHit(ray, blockTLAS, blockBVHs); });
+
+            // Primary rays of every pixel by 4x4 blocks, one at a time against one packet per block
+            auto benchBlocks = [&](const char* name, auto traceBlock) {
+                uint nbHits = 0;
+                const uint blockW = RayPacket16::WIDTH, blockH = RayPacket16::SIZE / RayPacket16::WIDTH;
+                auto start = std::chrono::steady_clock::now();
+                for (uint y0 = 0; y0 < H - blockH + 1; y0 += blockH) {
+                    for (uint x0 = 0; x0 < W - blockW + 1; x0 += blockW) {
+                        Ray rays[RayPacket16::SIZE];
+                        for (uint i = 0; i < RayPacket16::SIZE; i++) {
+                            rays[i] = cam->generate_ray(x0 + i % blockW, y0 + i / blockW);
+                        }
+                        nbHits += traceBlock(rays);
                     }
-                    cam->setPixel(h*W+w, color);
                 }
+                auto end = std::chrono::steady_clock::now();
+                std::chrono::duration<float> elapsed_seconds = end-start;
+                const uint nbPixels = (H / blockH) * (W / blockW) * RayPacket16::SIZE;
+                std::cout << name << ":\t" << nbPixels/elapsed_seconds.count()/1e6 << " Mrays/s (" << nbHits << " hits)\n";
+            };
+            benchBlocks("TLAS, all pixels", [&](Ray* rays) {
+                uint nbHits = 0;
+                for (uint i = 0; i < RayPacket16::SIZE; i++) {
+                    nbHits += closestHit(rays[i], hostTLAS, hostBVHs);
+                }
+                return nbHits;
+            });
+            benchBlocks("Packets 4x4", [&](Ray* rays) {
+                RayPacket16 packet = RayPacket16(rays, RayPacket16::SIZE);
+                packet.trace(hostTLAS, hostBVHs);
+                uint nbHits = 0;
+                for (uint i = 0; i < RayPacket16::SIZE; i++) {
+                    nbHits += packet.getHit(i, hostBVHs).getHasHit();
+                }
+                return nbHits;
+            });
+
+            // Quantized copies of the same BVHs, node memory against decoding work
+            Array<QBVH8> hostQBVH8s = Array<QBVH8>();
+            Array<QBVH16> hostQBVH16s = Array<QBVH16>();
+            size_t nodeBytes = 0, nodeBytes8 = 0, nodeBytes16 = 0;
+            for (uint i=0; i<hostBVHs.size(); i++) {
+                hostQBVH8s.push_back(QBVH8(hostBVHs[i]));
+                hostQBVH16s.push_back(QBVH16(hostBVHs[i]));
+                nodeBytes += hostBVHs[i].allNodes.size() * sizeof(Node);
+                nodeBytes8 += hostQBVH8s[-1].nodeBytes();
+                nodeBytes16 += hostQBVH16s[-1].nodeBytes();
             }
-            if (mode==BVH_RAYTRACING) {
-                for (uint i=0; i<BVHs.size(); i++) {
-                    BVHs[i].free();
+            std::cout << "Node memory:\t" << nodeBytes << " B float, " << nodeBytes16 << " B 16 bits, " << nodeBytes8 << " B 8 bits\n";
+            bench("QBVH16 list", [&](Ray& ray) { return closestHit(ray, hostQBVH16s); });
+            bench("QBVH8 list", [&](Ray& ray) { return closestHit(ray, hostQBVH8s); });
+
+            // Same TLAS over spatial split BVHs, with the work per ray of both builders
+            BVHParams spatialParams;
+            spatialParams.spatialSplits = true;
+            Array<BVH> spatialBVHs = buildBVHs("SBVH", spatialParams);
+            TLAS spatialTLAS = TLAS(spatialBVHs);
+            bench("SBVH TLAS", [&](Ray& ray) { return closestHit(ray, spatialTLAS, spatialBVHs); });
+
+            // Morton order build, meant for per frame rebuilds
+            BVHParams linearParams;
+            linearParams.linearBuild = true;
+            Array<BVH> linearBVHs = buildBVHs("LBVH", linearParams);
+            TLAS linearTLAS = TLAS(linearBVHs);
+            bench("LBVH TLAS", [&](Ray& ray) { return closestHit(ray, linearTLAS, linearBVHs); });
+
+            // Lazy build : the first traced frame pays for the subtrees it enters, the second one traces a partial tree
+            BVHParams lazyParams;
+            lazyParams.lazyBuild = true;
+            Array<BVH> lazyBVHs = buildBVHs("Lazy", lazyParams);
+            bench("Lazy list, 1st", [&](Ray& ray) { return closestHit(ray, lazyBVHs); });
+            bench("Lazy list, 2nd", [&](Ray& ray) { return closestHit(ray, lazyBVHs); });
+
+            auto steps = [&](const char* name, const TLAS& tlas, const Array<BVH>& bvhs) {
+                float sahCost = 0.f;
+                uint nbReferences = 0;
+                for (uint i=0; i<bvhs.size(); i++) {
+                    sahCost += bvhs[i].computeSAHCost();
+                    nbReferences += bvhs[i].size();
                 }
-                BVHs.free();
+                size_t nodes = 0, triangles = 0;
+                for (uint h = 0; h < H - stride + 1; h += stride) {
+                    for (uint w = 0; w < W - stride + 1; w += stride) {
+                        const TraversalStats stats = cam->generate_ray(w, h).traversalSteps(tlas, bvhs);
+                        nodes += stats.nodes;
+                        triangles += stats.triangles;
+                    }
+                }
+                std::cout << name << ":\t" << nodes/(1.*nbRays) << " nodes + " << triangles/(1.*nbRays) << " triangles per ray (SAH cost "
+                    << sahCost << ", " << nbReferences << " references)\n";
+            };
+            steps("Steps BVH ", hostTLAS, hostBVHs);
+            steps("Steps SBVH", spatialTLAS, spatialBVHs);
+            steps("Steps LBVH", linearTLAS, linearBVHs);
+
+            // Shadow rays from every primary hit towards a point light above the scene
+            const Vector<float> lightPosition = Vector<float>(0., 0., 10.);
+            std::vector<Ray> shadowRays;
+            std::vector<float> shadowDistances;
+            for (uint h = 0; h < H - stride + 1; h += stride) {
+                for (uint w = 0; w < W - stride + 1; w += stride) {
+                    Ray ray = cam->generate_ray(w, h);
+                    Hit hit = Hit();
+                    Tracing::rayTriangleBVHs(ray, hostTLAS, hostBVHs, hit);
+                    if (!hit.getHasHit()) continue;
+                    const Vector<float> origin = hit.getPoint() + hit.getNormal()*1E-4f;
+                    shadowRays.push_back(Ray(origin, lightPosition - origin));
+                    shadowDistances.push_back((lightPosition - origin).norm());
+                }
+            }
+            auto benchShadow = [&](const char* name, auto trace) {
+                uint nbOccluded = 0;
+                auto start = std::chrono::steady_clock::now();
+                for (uint i = 0; i < shadowRays.size(); i++) {
+                    nbOccluded += trace(shadowRays[i], shadowDistances[i]);
+                }
+                auto end = std::chrono::steady_clock::now();
+                std::chrono::duration<float> elapsed_seconds = end-start;
+                std::cout << name << ":\t" << shadowRays.size()/elapsed_seconds.count()/1e6 << " Mrays/s (" << nbOccluded << " occluded)\n";
+            };
+            benchShadow("Shadow closest hit", [&](Ray ray, const float tMax) {
+                Hit hit = Hit();
+                Tracing::rayTriangleBVHs(ray, hostTLAS, hostBVHs, hit);
+                return hit.getHasHit() && hit.getDistance() < tMax;
+            });
+            benchShadow("Shadow any hit", [&](const Ray& ray, const float tMax) { return Tracing::occluded(ray, hostTLAS, hostBVHs, tMax); });
+
+            for (uint i=0; i<hostBVH4s.size(); i++) {
+                hostBVH4s[i].free();
+            }
+            hostBVH4s.free();
+            for (uint i=0; i<hostQBVH8s.size(); i++) {
+                hostQBVH8s[i].free();
+                hostQBVH16s[i].free();
             }
+            hostQBVH8s.free();
+            hostQBVH16s.free();
+            hostBVHs.free();
+            hostTLAS.free();
+            blockBVHs.free();
+            blockTLAS.free();
+            spatialBVHs.free();
+            spatialTLAS.free();
+            linearBVHs.free();
+            linearTLAS.free();
+            lazyBVHs.free();
         }
         
         void renderCudaBVH() {
             auto start = std::chrono::steady_clock::now();
-            int state  = rand() % 1000000000 + 1;
-            //std::cout << state << std::endl;
+            const uint state = frame++;
 
             if (cam->is_raytrace_enable) {
-                RayTraceShader raytrace = RayTraceShader({BVHs, *cam, samplesByThread}, state);
+                sampler.setSeed(state);
+                sampler.cuda();
+                RayTraceShader raytrace = RayTraceShader({BVHs, tlas, *cam, samplesByThread, sampler}, state);
                 compute_shader(raytrace);
                 //ConvolutionShader denoise = ConvolutionShader({ {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}}, *cam});
                 //compute_shader(denoise);
             } else {
-                RasterizeShader raster = RasterizeShader({BVHs, *cam}, state);
+                RasterizeShader raster = RasterizeShader({BVHs, tlas, *cam}, state);
                 compute_shader(raster);
             }
 
@@ -3,7 +3,21 @@
 #include "Vector.hpp"
 #include "Material.hpp"
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
+
+// Result of the intersection core, a full Hit is only built for the closest one
+struct TriangleHit {
+    float distance = INFINITY;
+    float u = 0.f;
+    float v = 0.f;
+    uint primitive = 0;
+};
+
+// Work done by one closest hit traversal, to compare acceleration structures
+struct TraversalStats {
+    uint nodes = 0; // Boxes visited, TLAS and BVH
+    uint triangles = 0; // Ray/triangle tests
+};
 
 class Hit {
     private:
@@ -3,7 +3,7 @@
 #include "Vector.hpp"
 #include "Matrix.hpp"
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
 
 class Line {
     protected:
@@ -27,6 +27,10 @@ class Line {
             return direction;
         } 
 
+        __host__ __device__ Vector<float> getInvDir() const {
+            return invDir;
+        }
+
         __host__ __device__ void setPoint(const Vector<float>& p) {
             point=p;
         } 
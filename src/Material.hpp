@@ -3,7 +3,7 @@
 #include "Pixel.hpp"
 #include "utils/Random.hpp"
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
 
 enum MaterialType {
     DEFAULT,
@@ -16,6 +16,7 @@ enum MaterialType {
 struct RayInfo {
     float env_refractive_index;
     bool isInside;
+    float pdf = Sampling::uniformHemispherePdf(); // Of the last direction Material::trace drew, per steradian
 };
 
 
@@ -102,10 +103,12 @@ class Material : public RandomInterface {
             emissionStrengh=s;
         }
 
-        __host__ __device__ Vector<float> getDiffusionDirection(const Vector<float>& ray_direction, Vector<float> normal, uint state) {
-            Vector<float> dir = randomDirection(state);
-            //normal *= sign(-ray_direction*normal);
-            return dir*sign(dir*normal);
+        // Cosine weighted on the side of normal
+        __host__ __device__ Vector<float> getDiffusionDirection(const Vector<float>& ray_direction, Vector<float> normal, RandomGenerator& random, float& pdf) {
+            const float u1 = random.randomValue();
+            const Sampling::DirectionSample sample = Sampling::cosineHemisphere(normal, u1, random.randomValue());
+            pdf = sample.pdf;
+            return sample.direction;
         }
 
         // Specular or reflexion direction
@@ -130,27 +133,31 @@ class Material : public RandomInterface {
             }
         }
 
-        __host__ __device__ Vector<float> trace(const Vector<float>& ray_direction, Vector<float> normal, RayInfo& ray_info, uint state) {
+        // random is the stream of this bounce of the path
+        __host__ __device__ Vector<float> trace(const Vector<float>& ray_direction, Vector<float> normal, RayInfo& ray_info, RandomGenerator& random) {
             // Diffusion
-            Vector<float> finalDirection = getDiffusionDirection(ray_direction, normal, state);
-            // Specular
-            if (specularProb >= randomValue(state)) {
+            Vector<float> finalDirection = getDiffusionDirection(ray_direction, normal, random, ray_info.pdf);
+            // Specular and refraction directions have no density, they keep the weight of a uniform hemisphere draw they always had
+            if (specularProb >= random.randomValue()) {
                 Vector<float> specularDir = getSpecularDirection(ray_direction, normal);
                 finalDirection = finalDirection.lerp(specularDir, specularSmoothness).normalize();
+                ray_info.pdf = Sampling::uniformHemispherePdf();
             }
             // Refraction
-            if (transparency >= randomValue(state)) {
+            if (transparency >= random.randomValue()) {
                 Vector<float> refractionDir = getRefractionDirection(ray_direction, normal, ray_info);
                 finalDirection = refractionDir;
+                ray_info.pdf = Sampling::uniformHemispherePdf();
             }
             return finalDirection;
         }
 
-        __host__ __device__ void shade(Vector<float>* incomingLight, Vector<float>* rayColor, const Vector<float>& ray_direction, Vector<float> normal, const float dist) const {
+        // Lambertian weight of the new direction ray_direction, drawn with density pdf
+        __host__ __device__ void shade(Vector<float>* incomingLight, Vector<float>* rayColor, const Vector<float>& ray_direction, Vector<float> normal, const float dist, const float pdf) const {
             Vector<float> emittedLight = emissionColor.toVector() * emissionStrengh;
             *incomingLight += emittedLight.productTermByTerm(*rayColor);//* 5./(dist*dist);
             //incomingLight->clamp(0.f, 1.f);
-            *rayColor = rayColor->productTermByTerm(emissionColor.toVector()*(normal*ray_direction) * 2);
+            *rayColor = rayColor->productTermByTerm(emissionColor.toVector()*((normal*ray_direction) / (Sampling::Pi * pdf)));
         }
 };
 
@@ -3,7 +3,7 @@
 #include <cstring>
 #include <cmath>
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
 
 #define MATRIX_ZERO 0
 #define MATRIX_EYE 1
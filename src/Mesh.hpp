@@ -1,7 +1,210 @@
 #pragma once
 
+#include <cstdint>
+#include <stdexcept>
+
 #include "Triangle.hpp"
+#include "Material.hpp"
 #include "utils/Array.hpp"
+#include "utils/Hash.hpp"
 
 using Mesh = Array<Triangle>;
-using Meshes = Array<Mesh>;
\ No newline at end of file
+using Meshes = Array<Mesh>;
+
+/*
+Indexed triangle mesh : vertices are shared between triangles and stored as SoA,
+each triangle holds 3 vertex indices and a small id into the mesh material table.
+A mesh without normals falls back on the geometric normal, like Triangle does.
+*/
+class IndexedMesh : public CudaReady {
+    private:
+        Array<float> px, py, pz;
+        Array<float> nx, ny, nz;
+        Array<uint> indices; // 3 per triangle
+        Array<uint16_t> materialIds;
+        Array<Material> materials;
+
+    public:
+        __host__ IndexedMesh() {};
+
+        // Triangle soup, without vertex sharing
+        __host__ IndexedMesh(const Mesh& mesh) {
+            for (uint t = 0; t < mesh.size(); t++) {
+                addTriangle(mesh[t]);
+            }
+        };
+
+        __host__ uint addVertex(const Vector<float>& position, const Vector<float>& normal) {
+            nx.push_back(normal.getX());
+            ny.push_back(normal.getY());
+            nz.push_back(normal.getZ());
+            return addVertex(position);
+        }
+
+        __host__ uint addVertex(const Vector<float>& position) {
+            px.push_back(position.getX());
+            py.push_back(position.getY());
+            return pz.push_back(position.getZ());
+        }
+
+        // Triangles hold 16 bits ids, so a mesh has at most 65536 materials
+        __host__ uint16_t addMaterial(const Material& mat) {
+            if (materials.size() > UINT16_MAX) throw std::length_error("More than 65536 materials in a mesh");
+            return materials.push_back(mat);
+        }
+
+        __host__ uint addTriangle(const uint i0, const uint i1, const uint i2, const uint16_t materialId) {
+            indices.push_back(i0);
+            indices.push_back(i1);
+            indices.push_back(i2);
+            return materialIds.push_back(materialId);
+        }
+
+        __host__ uint addTriangle(const Triangle& tri) {
+            uint idx[3];
+            for (uint k = 0; k < 3; k++) {
+                idx[k] = addVertex(tri.getVertex(k), tri.getNormal(k));
+            }
+            return addTriangle(idx[0], idx[1], idx[2], addMaterial(tri.getMaterial()));
+        }
+
+        __host__ __device__ uint size() const {
+            return materialIds.size();
+        }
+
+        __host__ __device__ uint getNumVertices() const {
+            return px.size();
+        }
+
+        __host__ __device__ bool hasNormals() const {
+            return nx.size() == px.size() && nx.size() > 0;
+        }
+
+        __host__ __device__ uint getIndex(const uint triangle, const uint k) const {
+            return indices[3*triangle + k];
+        }
+
+        __host__ __device__ Vector<float> getPosition(const uint vertex) const {
+            return Vector<float>(px[vertex], py[vertex], pz[vertex]);
+        }
+
+        __host__ __device__ void setPosition(const uint vertex, const Vector<float>& position) {
+            px[vertex] = position.getX();
+            py[vertex] = position.getY();
+            pz[vertex] = position.getZ();
+        }
+
+        __host__ __device__ void move(const Vector<float>& vec) {
+            for (uint i = 0; i < getNumVertices(); i++) {
+                px[i] += vec.getX();
+                py[i] += vec.getY();
+                pz[i] += vec.getZ();
+            }
+        }
+
+        __host__ __device__ Vector<float> getVertex(const uint triangle, const uint k) const {
+            return getPosition(getIndex(triangle, k));
+        }
+
+        __host__ __device__ Vector<float> getNormal(const uint triangle, const uint k) const {
+            if (!hasNormals()) return Vector<float>();
+            const uint vertex = getIndex(triangle, k);
+            return Vector<float>(nx[vertex], ny[vertex], nz[vertex]);
+        }
+
+        __host__ __device__ Vector<float> getMin(const uint triangle) const {
+            return getVertex(triangle, 0).min(getVertex(triangle, 1).min(getVertex(triangle, 2)));
+        }
+
+        __host__ __device__ Vector<float> getMax(const uint triangle) const {
+            return getVertex(triangle, 0).max(getVertex(triangle, 1).max(getVertex(triangle, 2)));
+        }
+
+        __host__ __device__ Vector<float> getBarycenter(const uint triangle) const {
+            return (getVertex(triangle, 0) + getVertex(triangle, 1) + getVertex(triangle, 2))/3;
+        }
+
+        __host__ __device__ TriangleEdges getEdges(const uint triangle) const {
+            const Vector<float> vertex0 = getVertex(triangle, 0);
+            const Vector<float> edgeAB = getVertex(triangle, 1) - vertex0;
+            const Vector<float> edgeAC = getVertex(triangle, 2) - vertex0;
+            return {vertex0, edgeAB, edgeAC, edgeAB.crossProduct(edgeAC)};
+        }
+
+        __host__ __device__ Vector<float> getNormalVector(const uint triangle, const float u, const float v, const float w) const {
+            const Vector<float> normal0 = getNormal(triangle, 0);
+            const Vector<float> normal1 = getNormal(triangle, 1);
+            const Vector<float> normal2 = getNormal(triangle, 2);
+            if (normal0 == Vector<float>() || normal1 == Vector<float>() || normal2 == Vector<float>())
+                return getEdges(triangle).normal.normalize();
+            return (normal0*w + normal1*u + normal2*v).normalize();
+        }
+
+        __host__ __device__ const Material& getMaterial(const uint triangle) const {
+            return materials[materialIds[triangle]];
+        }
+
+        __host__ Triangle getTriangle(const uint triangle) const {
+            Triangle tri = Triangle(getMaterial(triangle));
+            for (uint k = 0; k < 3; k++) {
+                tri.setvertex(k, getVertex(triangle, k));
+                if (hasNormals()) tri.setNormal(k, getNormal(triangle, k));
+            }
+            return tri;
+        }
+
+        // Bytes used by the geometry, vertex/index/material buffers only
+        __host__ size_t bytes() const {
+            return (px.size() + py.size() + pz.size() + nx.size() + ny.size() + nz.size()) * sizeof(float)
+                + indices.size() * sizeof(uint) + materialIds.size() * sizeof(uint16_t) + materials.size() * sizeof(Material);
+        }
+
+        // Hash of everything a BVH depends on : positions and triangle indices
+        __host__ uint64_t hash(uint64_t seed = 0xcbf29ce484222325ull) const {
+            seed = Utils::hash(px.getCPUData(), px.size() * sizeof(float), seed);
+            seed = Utils::hash(py.getCPUData(), py.size() * sizeof(float), seed);
+            seed = Utils::hash(pz.getCPUData(), pz.size() * sizeof(float), seed);
+            return Utils::hash(indices.getCPUData(), indices.size() * sizeof(uint), seed);
+        }
+
+        __host__ void cuda() override {
+            px.cuda(); py.cuda(); pz.cuda();
+            nx.cuda(); ny.cuda(); nz.cuda();
+            indices.cuda();
+            materialIds.cuda();
+            materials.cuda();
+        }
+
+        __host__ void cpu() override {
+            px.cpu(); py.cpu(); pz.cpu();
+            nx.cpu(); ny.cpu(); nz.cpu();
+            indices.cpu();
+            materialIds.cpu();
+            materials.cpu();
+        }
+
+        __host__ void sync_to_cpu() override {
+            px.sync_to_cpu(); py.sync_to_cpu(); pz.sync_to_cpu();
+            nx.sync_to_cpu(); ny.sync_to_cpu(); nz.sync_to_cpu();
+            indices.sync_to_cpu();
+            materialIds.sync_to_cpu();
+            materials.sync_to_cpu();
+        }
+
+        // Device copy of a mesh shared with its owner, see BVH::free
+        __host__ void freeDevice() {
+            px.freeDevice(); py.freeDevice(); pz.freeDevice();
+            nx.freeDevice(); ny.freeDevice(); nz.freeDevice();
+            indices.freeDevice();
+            materialIds.freeDevice();
+            materials.freeDevice();
+        }
+
+        __host__ void free() override {
+            px.free(); py.free(); pz.free();
+            nx.free(); ny.free(); nz.free();
+            indices.free();
+            materialIds.free();
+            materials.free();
+        }
+};
@@ -1,14 +1,18 @@
 #pragma once
 #include "Vector.hpp"
+#include "Matrix.hpp"
+#include "Mesh.hpp"
 
 #include <vector>
 #include <cstring>
 #include <sstream>
 #include <fstream>
+#include <map>
 
 class Obj {
     private:
         std::string nameObj;
+        std::string filePath;
         std::vector<Vector<float>> v;
         std::vector<Vector<float>> vt;
         std::vector<Vector<float>> vn;
@@ -32,7 +36,8 @@ class Obj {
     public:
         Obj(const std::string name) {
             std::string path = std::string("./models/");
-            std::ifstream monFlux((path+name).c_str());
+            filePath = path+name;
+            std::ifstream monFlux(filePath.c_str());
             std::string ligne;
 
             while (getline(monFlux, ligne)) {
@@ -86,6 +91,10 @@ class Obj {
             vn.push_back(vertex);
         }
 
+        std::string getPath() const {
+            return filePath;
+        }
+
         std::vector<Vector<float>> getVertices() const {
             return v;
         }
@@ -102,6 +111,55 @@ class Obj {
             return trianglesVecticesIndexes;
         }
 
+        // Indexed mesh of the model, rotated upright then scaled and moved
+        IndexedMesh toMesh(const Vector<float>& offset, const float scale, const Material& mat) {
+            std::vector<Vector<float>> vertices = getVertices();
+            std::vector<Vector<float>> normal_vertices = getNormalVertices();
+            std::vector<std::vector<Vector<int>>> indexes = getIndexes();
+
+            float angle = 3.14159/2.0;
+            float ux = 1;
+            float uy = 0;
+            float uz = 0;
+            Matrix<float> P = Matrix<float>(ux*ux,ux*uy,ux*uz,ux*uy,uy*uy,uy*uz,ux*uz,uy*uz,uz*uz);
+            Matrix<float> I = Matrix<float>(1.,MATRIX_EYE);
+            Matrix<float> Q = Matrix<float>(0,-uz,uy,uz,0,-ux,-uy,ux,0);
+
+            Matrix<float> R = P + (I-P)*std::cos(angle) + Q*std::sin(angle);
+
+            /*
+            The OBJ format can provide multiple vertices for one triangle. We have to convert it in triangles as follow.
+            A vertex is shared by every face using the same position/normal pair.
+            */
+            IndexedMesh mesh = IndexedMesh();
+            const uint16_t materialId = mesh.addMaterial(mat);
+            std::map<std::pair<int, int>, uint> sharedVertices;
+            auto vertexIndex = [&](const Vector<int>& f) {
+                const std::pair<int, int> key = {f.getX(), f.getZ()};
+                auto it = sharedVertices.find(key);
+                if (it != sharedVertices.end()) return it->second;
+
+                const Vector<float> normal = (0 <= f.getZ() && f.getZ() < (int)normal_vertices.size()) ? (R*normal_vertices[f.getZ()]).normalize() : Vector<float>();
+                const uint idx = mesh.addVertex(R*vertices[f.getX()]*scale + offset, normal);
+                sharedVertices[key] = idx;
+                return idx;
+            };
+
+            for (uint i=0;i<indexes.size();i++) {
+                std::vector<Vector<int>> fi = indexes[i];
+
+                for (uint v=2;v<fi.size();v++) {
+                    if (v==2) {
+                        mesh.addTriangle(vertexIndex(fi[0]), vertexIndex(fi[1]), vertexIndex(fi[2]), materialId);
+                    } else {
+                        mesh.addTriangle(vertexIndex(fi[v-3]), vertexIndex(fi[v-1]), vertexIndex(fi[v]), materialId);
+                    }
+                    nbTriangles += 1;
+                }
+            }
+            return mesh;
+        }
+
         void print() const {
             for (uint i=0;i<v.size();i++) {
                 v[i].printCoord();
@@ -6,7 +6,7 @@
 #include <iostream>
 #include <fstream>
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
 
 class Pixel {
     private:
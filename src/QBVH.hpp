@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "BVH.hpp"
+#include "utils/Array.hpp"
+
+/*
+Binary node with the bounds of both children quantized on a grid of Q steps per axis spanning this node's own box.
+The box itself is not stored : traversal decodes it from the parent, starting from the float root bounds of the BVH.
+child[i] follows the Node encoding : LEAF_FLAG set means a triangle range of count[i] triangles.
+*/
+template <typename Q>
+struct QNode {
+    static constexpr uint LEAF_FLAG = 0x80000000u;
+    static constexpr uint STEPS = std::numeric_limits<Q>::max();
+
+    uint child[2];
+    uint count[2];
+    Q lo[2][3];
+    Q hi[2][3];
+
+    // Conservative decoding : the two ends of the grid give back the exact parent bounds
+    __host__ __device__ static float Decode(const Q q, const float parentMin, const float parentMax, const float step) {
+        const float value = parentMin + q * step;
+        return q == 0 ? parentMin : q == STEPS ? parentMax : value;
+    }
+
+    __host__ __device__ static float Step(const float parentMin, const float parentMax) {
+        return (parentMax - parentMin) / STEPS;
+    }
+
+    __host__ __device__ void decode(const Vector<float>& parentMin, const Vector<float>& parentMax, Vector<float> childMin[2], Vector<float> childMax[2]) const {
+        const float stepX = Step(parentMin.getX(), parentMax.getX());
+        const float stepY = Step(parentMin.getY(), parentMax.getY());
+        const float stepZ = Step(parentMin.getZ(), parentMax.getZ());
+        for (uint i = 0; i < 2; i++) {
+            childMin[i] = Vector<float>(Decode(lo[i][0], parentMin.getX(), parentMax.getX(), stepX),
+                Decode(lo[i][1], parentMin.getY(), parentMax.getY(), stepY), Decode(lo[i][2], parentMin.getZ(), parentMax.getZ(), stepZ));
+            childMax[i] = Vector<float>(Decode(hi[i][0], parentMin.getX(), parentMax.getX(), stepX),
+                Decode(hi[i][1], parentMin.getY(), parentMax.getY(), stepY), Decode(hi[i][2], parentMin.getZ(), parentMax.getZ(), stepZ));
+        }
+    }
+
+    // Rounds outwards, then steps the grid until the decoded value really encloses the float one
+    __host__ static Q EncodeMin(const float value, const float parentMin, const float parentMax) {
+        if (!(parentMax > parentMin)) return 0;
+        long q = (long)std::floor((value - parentMin) / (parentMax - parentMin) * STEPS);
+        q = q < 0 ? 0 : q > (long)STEPS ? STEPS : q;
+        while (q > 0 && Decode(q, parentMin, parentMax, Step(parentMin, parentMax)) > value) q--;
+        return q;
+    }
+
+    __host__ static Q EncodeMax(const float value, const float parentMin, const float parentMax) {
+        if (!(parentMax > parentMin)) return STEPS;
+        long q = (long)std::ceil((value - parentMin) / (parentMax - parentMin) * STEPS);
+        q = q < 0 ? 0 : q > (long)STEPS ? STEPS : q;
+        while (q < (long)STEPS && Decode(q, parentMin, parentMax, Step(parentMin, parentMax)) < value) q++;
+        return q;
+    }
+
+    __host__ BoundingBox decoded(const uint i, const BoundingBox& parent) const {
+        Vector<float> childMin[2], childMax[2];
+        decode(parent.getMin(), parent.getMax(), childMin, childMax);
+        BoundingBox box;
+        box.growToInclude(childMin[i], childMax[i]);
+        return box;
+    }
+
+    // Encodes child i against the decoded parent box and returns the box traversal will see for it
+    __host__ BoundingBox setChild(const uint i, const Node& node, const BoundingBox& parent) {
+        child[i] = node.isLeaf() ? (node.getTriangleIndex() | LEAF_FLAG) : 0;
+        count[i] = node.getTriangleCount();
+        const Vector<float> pMin = parent.getMin();
+        const Vector<float> pMax = parent.getMax();
+        if (node.isLeaf() && node.getTriangleCount() == 0) {
+            // Empty leaf : an inverted box no ray can enter
+            for (uint k = 0; k < 3; k++) {
+                lo[i][k] = STEPS;
+                hi[i][k] = 0;
+            }
+            return decoded(i, parent);
+        }
+        const Vector<float> nMin = node.getMin();
+        const Vector<float> nMax = node.getMax();
+        lo[i][0] = EncodeMin(nMin.getX(), pMin.getX(), pMax.getX());
+        lo[i][1] = EncodeMin(nMin.getY(), pMin.getY(), pMax.getY());
+        lo[i][2] = EncodeMin(nMin.getZ(), pMin.getZ(), pMax.getZ());
+        hi[i][0] = EncodeMax(nMax.getX(), pMin.getX(), pMax.getX());
+        hi[i][1] = EncodeMax(nMax.getY(), pMin.getY(), pMax.getY());
+        hi[i][2] = EncodeMax(nMax.getZ(), pMin.getZ(), pMax.getZ());
+        return decoded(i, parent);
+    }
+};
+
+/*
+Compressed copy of a binary BVH, for large scenes where node memory matters more than decoding work.
+Chosen per BVH : QBVH<uint8_t> nodes take 28 bytes and QBVH<uint16_t> ones 40 bytes, for two children, against 64 bytes for a pair of Node.
+Decoded boxes always enclose the float ones, so traversal visits a superset of the nodes and finds the same hits.
+For the CPU path only, triangles are shared with the source BVH.
+*/
+template <typename Q>
+class QBVH {
+    private:
+        // Returns the index of the quantized node holding the children of the binary interior node binaryIndex
+        __host__ uint compress(const BVH& bvh, const uint binaryIndex, const BoundingBox& box) {
+            const uint childIndex = bvh.allNodes[binaryIndex].getChildIndex();
+            const uint index = allNodes.push_back(QNode<Q>());
+            for (uint i = 0; i < 2; i++) {
+                const Node& node = bvh.allNodes[childIndex + i];
+                const BoundingBox childBox = allNodes[index].setChild(i, node, box);
+                if (!node.isLeaf()) {
+                    // Recursion may reallocate allNodes, so write the child index afterwards
+                    const uint compressed = compress(bvh, childIndex + i, childBox);
+                    allNodes[index].child[i] = compressed;
+                }
+            }
+            return index;
+        }
+
+    public:
+        Array<QNode<Q>> allNodes;
+        BoundingBox rootBounds;
+        IndexedMesh mesh;
+        Array<uint> triangleIndices;
+        Array<TriangleEdges> allEdges;
+
+        __host__ QBVH() {};
+        __host__ QBVH(const BVH& bvh) : mesh(bvh.mesh), triangleIndices(bvh.triangleIndices), allEdges(bvh.allEdges) {
+            if (bvh.allNodes.size() == 0) return;
+            bvh.expandAll();
+            const Node& root = bvh.allNodes[0];
+            rootBounds = root.getBoundingBox();
+            if (root.isLeaf()) {
+                // Single leaf tree : one node with the leaf and an empty sibling
+                const uint index = allNodes.push_back(QNode<Q>());
+                allNodes[index].setChild(0, root, rootBounds);
+                allNodes[index].setChild(1, Node(0u), rootBounds);
+                return;
+            }
+            compress(bvh, 0, rootBounds);
+        };
+
+        __host__ size_t nodeBytes() const {
+            return allNodes.size() * sizeof(QNode<Q>);
+        }
+
+        // Only the quantized nodes are owned, the triangle data belongs to the source BVH
+        __host__ void free() {
+            allNodes.free();
+        }
+};
+
+using QBVH8 = QBVH<uint8_t>;
+using QBVH16 = QBVH<uint16_t>;
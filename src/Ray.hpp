@@ -7,9 +7,16 @@
 #include "Hit.hpp"
 #include "Mesh.hpp"
 #include "BVH.hpp"
+#include "TLAS.hpp"
+#include "BVH4.hpp"
+#include "QBVH.hpp"
 #include "utils/MinMax.hpp"
 #include "utils/Random.hpp"
 
+#if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+#include <immintrin.h>
+#endif
+
 
 class Ray : public Line {
     private:
@@ -46,9 +53,9 @@ class Ray : public Line {
             return groundColor.lerp(skyGradient, groundToSkyT) + sun * (groundToSkyT >= 1);
         }
 
-        __host__ __device__ void updateRay(const Hit& hit, uint state) {
+        __host__ __device__ void updateRay(const Hit& hit, RandomGenerator& random) {
             Material mat = hit.getMaterial();
-            const Vector<float> finalDirection = mat.trace(direction, hit.getNormal(), ray_info, state);
+            const Vector<float> finalDirection = mat.trace(direction, hit.getNormal(), ray_info, random);
             // New ray after bounce
             setPoint(hit.getPoint());
             setDirection(finalDirection);
@@ -56,13 +63,21 @@ class Ray : public Line {
 
         __host__ __device__ void updateLight(const Hit& hit, Vector<float>* incomingLight, Vector<float>* rayColor) const {
             Material mat = hit.getMaterial();
-            mat.shade(incomingLight, rayColor, direction, hit.getNormal(), hit.getDistanceTraveled());
+            mat.shade(incomingLight, rayColor, direction, hit.getNormal(), hit.getDistanceTraveled(), ray_info.pdf);
         }
 
         // Thanks to https://tavianator.com/2011/ray_box.html
         __host__ __device__ float distToBounds(const BoundingBox& bounds) const {
-            const Vector<float> tMin = (bounds.getMin() - point).productTermByTerm(invDir);
-            const Vector<float> tMax = (bounds.getMax() - point).productTermByTerm(invDir);
+            return distToBounds(bounds.getMin(), bounds.getMax());
+        }
+
+        __host__ __device__ float distToBounds(const Node& node) const {
+            return distToBounds(node.getMin(), node.getMax());
+        }
+
+        __host__ __device__ float distToBounds(const Vector<float>& boundsMin, const Vector<float>& boundsMax) const {
+            const Vector<float> tMin = (boundsMin - point).productTermByTerm(invDir);
+            const Vector<float> tMax = (boundsMax - point).productTermByTerm(invDir);
             const Vector<float> t1 = tMin.min(tMax);
             const Vector<float> t2 = tMin.max(tMax);
             const float tNear = Utils::max(Utils::max(t1.getX(), t1.getY()), t1.getZ());
@@ -73,54 +88,142 @@ class Ray : public Line {
             return dst;
         }
 
-        __host__ __device__ Hit rayTriangle(const Triangle& tri) const {           
-            const Vector<float> edgeAB = tri.getVertex(1) - tri.getVertex(0);
-            const Vector<float> edgeAC = tri.getVertex(2) - tri.getVertex(0);
-            const Vector<float> normalVector = edgeAB.crossProduct(edgeAC);
-            const Vector<float> ao = point - tri.getVertex(0);
-            const Vector<float> dao = ao.crossProduct(direction);
-
-            const float determinant = -direction*normalVector;
+        // Intersection core, closest is only overwritten by a hit strictly closer than closest.distance
+        __host__ __device__ bool intersect(const TriangleEdges& tri, const uint primitive, TriangleHit& closest) const {
+            const float determinant = -direction*tri.normal;
+            if (std::abs(determinant) < 1E-8) return false;
             const float invDet = 1.0 / determinant;
 
             // Calculate dst to triangle & barycentric coordinates of intersection point
-            const float dst = (ao*normalVector) * invDet;
-            const float u = (edgeAC*dao) * invDet;
-            const float v = -(edgeAB*dao) * invDet;
-            const float w = 1.0 - u - v;
+            const Vector<float> ao = point - tri.vertex0;
+            const float dst = (ao*tri.normal) * invDet;
+            if (dst < 1E-8 || dst >= closest.distance) return false;
+
+            const Vector<float> dao = ao.crossProduct(direction);
+            const float u = (tri.edgeAC*dao) * invDet;
+            const float v = -(tri.edgeAB*dao) * invDet;
+            if (u < 1E-8 || v < 1E-8 || 1.0 - u - v < 1E-8) return false;
+
+            closest = {dst, u, v, primitive};
+            return true;
+        }
+
+#if (defined(__SSE2__) || defined(__AVX__)) && !defined(__CUDA_ARCH__)
+        // Same test against the count first triangles of a block at once, the closest of them by a horizontal min.
+        // firstPrimitive is the primitive of lane 0, lanes are tested in order so that ties go to the same triangle as intersect
+        __host__ bool intersect(const TriangleBlock& block, const uint count, const uint firstPrimitive, TriangleHit& closest) const {
+            using namespace Simd;
+            const Lanes nx = load(block.normal[0]), ny = load(block.normal[1]), nz = load(block.normal[2]);
+            const Lanes signMask = set1(-0.f), eps = set1(1E-8f), one = set1(1.f);
+
+            const Lanes determinant = xorMask(signMask, add(add(mul(set1(direction.getX()), nx), mul(set1(direction.getY()), ny)), mul(set1(direction.getZ()), nz)));
+            Lanes valid = cmpge(andNot(signMask, determinant), eps);
+            const Lanes invDet = div(one, determinant);
+
+            const Lanes aox = sub(set1(point.getX()), load(block.vertex0[0]));
+            const Lanes aoy = sub(set1(point.getY()), load(block.vertex0[1]));
+            const Lanes aoz = sub(set1(point.getZ()), load(block.vertex0[2]));
+            const Lanes dst = mul(add(add(mul(aox, nx), mul(aoy, ny)), mul(aoz, nz)), invDet);
+            valid = andMask(valid, andMask(cmpge(dst, eps), cmplt(dst, set1(closest.distance))));
+            const int lanes = (1 << count) - 1;
+            if ((moveMask(valid) & lanes) == 0) return false;
+
+            // dao = ao x direction
+            const Lanes rx = set1(direction.getX()), ry = set1(direction.getY()), rz = set1(direction.getZ());
+            const Lanes daox = sub(mul(aoy, rz), mul(aoz, ry));
+            const Lanes daoy = sub(mul(aoz, rx), mul(aox, rz));
+            const Lanes daoz = sub(mul(aox, ry), mul(aoy, rx));
+            const Lanes u = mul(add(add(mul(load(block.edgeAC[0]), daox), mul(load(block.edgeAC[1]), daoy)), mul(load(block.edgeAC[2]), daoz)), invDet);
+            const Lanes v = xorMask(signMask, mul(add(add(mul(load(block.edgeAB[0]), daox), mul(load(block.edgeAB[1]), daoy)), mul(load(block.edgeAB[2]), daoz)), invDet));
+            valid = andMask(valid, andMask(andMask(cmpge(u, eps), cmpge(v, eps)), cmpge(sub(sub(one, u), v), eps)));
+            const int hits = moveMask(valid) & lanes;
+            if (hits == 0) return false;
 
-            // Initialize hit info
+            const Lanes dstHit = orMask(andMask(valid, dst), andNot(valid, set1(INFINITY)));
+            const int nearest = moveMask(cmpeq(dstHit, horizontalMin(dstHit))) & hits;
+            const uint lane = __builtin_ctz(nearest);
+            alignas(32) float values[TriangleBlock::WIDTH];
+            store(values, dst);
+            closest.distance = values[lane];
+            store(values, u);
+            closest.u = values[lane];
+            store(values, v);
+            closest.v = values[lane];
+            closest.primitive = firstPrimitive + lane;
+            return true;
+        }
+#endif
+
+        // Triangles [start, start + count) of a leaf, by blocks when the BVH has them
+        __host__ __device__ bool intersectLeaf(const BVH& bvh, const uint nodeIndex, const uint start, const uint count, TriangleHit& closest) const {
+            bool didHit = false;
+#if (defined(__SSE2__) || defined(__AVX__)) && !defined(__CUDA_ARCH__)
+            if (bvh.hasBlocks()) {
+                const uint firstBlock = bvh.leafBlocks[nodeIndex];
+                for (uint j = 0; j < count; j += TriangleBlock::WIDTH) {
+                    didHit |= intersect(bvh.allBlocks[firstBlock + j / TriangleBlock::WIDTH], Utils::min(TriangleBlock::WIDTH, count - j), start + j, closest);
+                }
+                return didHit;
+            }
+#endif
+            for (uint j = 0; j < count; j++) {
+                didHit |= intersect(bvh.allEdges[start + j], start + j, closest);
+            }
+            return didHit;
+        }
+
+        // Full hit info, computed once for the closest triangle only
+        __host__ __device__ Hit resolveHit(const Triangle& tri, const TriangleHit& closest) const {
             Hit hit;
-            const Vector<float> intersection = point + direction * dst;
-            hit.setHasHit(std::abs(determinant) >= 1E-8 && dst >= 1E-8 && u >= 1E-8 && v >= 1E-8 && w >= 1E-8);
-            hit.setPoint(intersection);
-            hit.setNormal(tri.getNormalVector(u, v, w));
+            hit.setHasHit(true);
+            hit.setPoint(point + direction * closest.distance);
+            hit.setNormal(tri.getNormalVector(closest.u, closest.v, 1.0 - closest.u - closest.v));
             hit.setMaterial(tri.getMaterial());
-            hit.setDistance(dst);
+            hit.setDistance(closest.distance);
             return hit;
         }
 
+        __host__ __device__ Hit resolveHit(const IndexedMesh& mesh, const uint triangle, const TriangleHit& closest) const {
+            Hit hit;
+            hit.setHasHit(true);
+            hit.setPoint(point + direction * closest.distance);
+            hit.setNormal(mesh.getNormalVector(triangle, closest.u, closest.v, 1.0 - closest.u - closest.v));
+            hit.setMaterial(mesh.getMaterial(triangle));
+            hit.setDistance(closest.distance);
+            return hit;
+        }
+
+        __host__ __device__ Hit rayTriangle(const Triangle& tri) const {
+            TriangleHit closest;
+            if (!intersect(tri.getEdges(), 0, closest)) return Hit();
+            return resolveHit(tri, closest);
+        }
+
+        // hit may already hold a closer intersection from another BVH, nothing farther than it is visited
         __host__ __device__ void rayTriangleBVH(const BVH& bvh, const uint nodeOffset, const uint triOffset, Hit& hit) {
-            Hit finalHit;
-            uint stack[128];
+            TriangleHit closest;
+            closest.distance = hit.getDistance();
+            uint stack[BVH::STACK_SIZE];
             uint stackIndex = 0;
             stack[stackIndex++] = nodeOffset + 0;
 
             while (stackIndex > 0) {
-                const Node node = bvh.allNodes[stack[--stackIndex]];
-                const bool isLeaf = node.getTriangleCount() > 0;
+                const uint nodeIndex = stack[--stackIndex];
+                #ifndef __CUDA_ARCH__
+                // Lazy build : the first ray entering a pending node splits it
+                if (bvh.allNodes[nodeIndex].isPending()) bvh.expand(nodeIndex - nodeOffset);
+                #endif
+                const Node& node = bvh.allNodes[nodeIndex];
+                const bool isLeaf = node.isLeaf();
 
                 if (isLeaf) {
-                    for (int j=0; j<node.getTriangleCount(); j++) {
-                        Hit hit_tmp = rayTriangle(bvh.allTriangles[triOffset + node.getTriangleIndex() + j]);
-                        finalHit.update(hit_tmp);
-                    }
+                    intersectLeaf(bvh, nodeIndex - nodeOffset, triOffset + node.getTriangleIndex(), node.getTriangleCount(), closest);
                 } else {
                     const uint childIndexA = nodeOffset + node.getChildIndex() + 0;
                     const uint childIndexB = nodeOffset + node.getChildIndex() + 1;
 
-                    const float dstA = distToBounds(bvh.allNodes[childIndexA].getBoundingBox());
-                    const float dstB = distToBounds(bvh.allNodes[childIndexB].getBoundingBox());
+                    const float dstA = distToBounds(bvh.allNodes[childIndexA]);
+                    const float dstB = distToBounds(bvh.allNodes[childIndexB]);
                     
                     // We want to look at closest child node first, so push it last
                     const bool isNearestA = dstA <= dstB;
@@ -129,14 +232,286 @@ class Ray : public Line {
                     const uint childIndexNear = isNearestA ? childIndexA : childIndexB;
                     const uint childIndexFar = isNearestA ? childIndexB : childIndexA;
 
-                    if (dstFar < finalHit.getDistance()) {
+                    if (dstFar < closest.distance) {
+                        stack[stackIndex++] = childIndexFar;
+                    }
+                    if (dstNear < closest.distance) {
+                        stack[stackIndex++] = childIndexNear;
+                    }
+                }
+            }
+            if (closest.distance < hit.getDistance()) {
+                hit.update(resolveHit(bvh.mesh, bvh.triangleIndices[closest.primitive], closest));
+            }
+        }
+
+        // Any hit query : true as soon as one triangle is hit closer than tMax, no hit record and no ordering
+        __host__ __device__ bool occludedBVH(const BVH& bvh, const float tMax) const {
+            TriangleHit closest;
+            closest.distance = tMax;
+            uint stack[BVH::STACK_SIZE];
+            uint stackIndex = 0;
+            stack[stackIndex++] = 0;
+
+            while (stackIndex > 0) {
+                const uint nodeIndex = stack[--stackIndex];
+                #ifndef __CUDA_ARCH__
+                if (bvh.allNodes[nodeIndex].isPending()) bvh.expand(nodeIndex);
+                #endif
+                const Node& node = bvh.allNodes[nodeIndex];
+
+                if (node.isLeaf()) {
+                    if (intersectLeaf(bvh, nodeIndex, node.getTriangleIndex(), node.getTriangleCount(), closest)) return true;
+                } else {
+                    const uint childIndex = node.getChildIndex();
+                    if (distToBounds(bvh.allNodes[childIndex + 0]) < tMax) {
+                        stack[stackIndex++] = childIndex + 0;
+                    }
+                    if (distToBounds(bvh.allNodes[childIndex + 1]) < tMax) {
+                        stack[stackIndex++] = childIndex + 1;
+                    }
+                }
+            }
+            return false;
+        }
+
+        __host__ __device__ bool occludedTLAS(const TLAS& tlas, const Array<BVH>& bvhs, const float tMax) const {
+            if (tlas.allNodes.size() == 0) return false;
+            uint stack[TLAS::STACK_SIZE];
+            uint stackIndex = 0;
+            stack[stackIndex++] = 0;
+
+            while (stackIndex > 0) {
+                const Node& node = tlas.allNodes[stack[--stackIndex]];
+
+                if (node.isLeaf()) {
+                    for (uint j=0; j<node.getTriangleCount(); j++) {
+                        if (occludedBVH(bvhs[tlas.bvhIndices[node.getTriangleIndex() + j]], tMax)) return true;
+                    }
+                } else {
+                    const uint childIndex = node.getChildIndex();
+                    if (distToBounds(tlas.allNodes[childIndex + 0]) < tMax) {
+                        stack[stackIndex++] = childIndex + 0;
+                    }
+                    if (distToBounds(tlas.allNodes[childIndex + 1]) < tMax) {
+                        stack[stackIndex++] = childIndex + 1;
+                    }
+                }
+            }
+            return false;
+        }
+
+        __host__ __device__ void rayTriangleTLAS(const TLAS& tlas, const Array<BVH>& bvhs, Hit& hit) {
+            if (tlas.allNodes.size() == 0) return;
+            uint stack[TLAS::STACK_SIZE];
+            uint stackIndex = 0;
+            stack[stackIndex++] = 0;
+
+            while (stackIndex > 0) {
+                const Node& node = tlas.allNodes[stack[--stackIndex]];
+                const bool isLeaf = node.isLeaf();
+
+                if (isLeaf) {
+                    for (uint j=0; j<node.getTriangleCount(); j++) {
+                        rayTriangleBVH(bvhs[tlas.bvhIndices[node.getTriangleIndex() + j]], 0, 0, hit);
+                    }
+                } else {
+                    const uint childIndexA = node.getChildIndex() + 0;
+                    const uint childIndexB = node.getChildIndex() + 1;
+
+                    const float dstA = distToBounds(tlas.allNodes[childIndexA]);
+                    const float dstB = distToBounds(tlas.allNodes[childIndexB]);
+
+                    const bool isNearestA = dstA <= dstB;
+                    const float dstNear = isNearestA ? dstA : dstB;
+                    const float dstFar = isNearestA ? dstB : dstA;
+                    const uint childIndexNear = isNearestA ? childIndexA : childIndexB;
+                    const uint childIndexFar = isNearestA ? childIndexB : childIndexA;
+
+                    // hit distance shrinks as BVHs are traced, so pruning tightens along the way
+                    if (dstFar < hit.getDistance()) {
                         stack[stackIndex++] = childIndexFar;
                     }
-                    if (dstNear < finalHit.getDistance()) {
+                    if (dstNear < hit.getDistance()) {
                         stack[stackIndex++] = childIndexNear;
                     }
                 }
             }
-            hit.update(finalHit);
+        }
+
+        // Same traversal as rayTriangleTLAS, counting visited nodes and triangle tests instead of resolving the hit
+        __host__ TraversalStats traversalSteps(const TLAS& tlas, const Array<BVH>& bvhs) const {
+            TraversalStats stats;
+            if (tlas.allNodes.size() == 0) return stats;
+            TriangleHit closest;
+            uint tlasStack[TLAS::STACK_SIZE];
+            uint tlasStackIndex = 0;
+            tlasStack[tlasStackIndex++] = 0;
+
+            // bvh is null for the TLAS, whose nodes are never pending
+            auto traverse = [&](const Array<Node>& nodes, const BVH* bvh, uint* stack, uint& stackIndex, auto leaf) {
+                while (stackIndex > 0) {
+                    const uint nodeIndex = stack[--stackIndex];
+                    if (bvh != nullptr && nodes[nodeIndex].isPending()) bvh->expand(nodeIndex);
+                    const Node& node = nodes[nodeIndex];
+                    stats.nodes++;
+                    if (node.isLeaf()) {
+                        leaf(node);
+                        continue;
+                    }
+                    const uint childIndex = node.getChildIndex();
+                    const float dstA = distToBounds(nodes[childIndex + 0]);
+                    const float dstB = distToBounds(nodes[childIndex + 1]);
+                    const bool isNearestA = dstA <= dstB;
+                    if (Utils::max(dstA, dstB) < closest.distance) stack[stackIndex++] = isNearestA ? childIndex + 1 : childIndex + 0;
+                    if (Utils::min(dstA, dstB) < closest.distance) stack[stackIndex++] = isNearestA ? childIndex + 0 : childIndex + 1;
+                }
+            };
+
+            traverse(tlas.allNodes, nullptr, tlasStack, tlasStackIndex, [&](const Node& tlasLeaf) {
+                for (uint j = 0; j < tlasLeaf.getTriangleCount(); j++) {
+                    const BVH& bvh = bvhs[tlas.bvhIndices[tlasLeaf.getTriangleIndex() + j]];
+                    uint stack[BVH::STACK_SIZE];
+                    uint stackIndex = 0;
+                    stack[stackIndex++] = 0;
+                    traverse(bvh.allNodes, &bvh, stack, stackIndex, [&](const Node& leaf) {
+                        for (uint k = 0; k < leaf.getTriangleCount(); k++) {
+                            stats.triangles++;
+                            intersect(bvh.allEdges[leaf.getTriangleIndex() + k], 0, closest);
+                        }
+                    });
+                }
+            });
+            return stats;
+        }
+
+        // Distances to the 4 child boxes of a wide node, INFINITY for missed or empty slots
+        __host__ void distToBounds4(const Node4& node, const float tMax, float dst[Node4::WIDTH]) const {
+        #if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+            const __m128 ox = _mm_set1_ps(point.getX()), oy = _mm_set1_ps(point.getY()), oz = _mm_set1_ps(point.getZ());
+            const __m128 ix = _mm_set1_ps(invDir.getX()), iy = _mm_set1_ps(invDir.getY()), iz = _mm_set1_ps(invDir.getZ());
+
+            const __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), ox), ix);
+            const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), ox), ix);
+            const __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), oy), iy);
+            const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), oy), iy);
+            const __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), oz), iz);
+            const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), oz), iz);
+
+            const __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+            const __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+
+            const __m128 didHit = _mm_cmple_ps(tNear, tFar);
+            _mm_storeu_ps(dst, _mm_or_ps(_mm_and_ps(didHit, tNear), _mm_andnot_ps(didHit, _mm_set1_ps(INFINITY))));
+        #else
+            for (uint i = 0; i < Node4::WIDTH; i++) {
+                const float d = distToBounds(Vector<float>(node.minX[i], node.minY[i], node.minZ[i]), Vector<float>(node.maxX[i], node.maxY[i], node.maxZ[i]));
+                dst[i] = d < tMax ? d : INFINITY;
+            }
+        #endif
+            for (uint i = node.numChildren; i < Node4::WIDTH; i++) {
+                dst[i] = INFINITY;
+            }
+        }
+
+        __host__ void rayTriangleBVH4(const BVH4& bvh, Hit& hit) {
+            if (bvh.allNodes.size() == 0) return;
+            TriangleHit closest;
+            closest.distance = hit.getDistance();
+
+            // Entries keep their box distance, so they can be skipped once a closer hit is found
+            struct Entry {
+                uint index;
+                uint count;
+                float dst;
+            };
+            Entry stack[BVH4::STACK_SIZE];
+            uint stackIndex = 0;
+            stack[stackIndex++] = {0, 0, 0.f};
+
+            while (stackIndex > 0) {
+                const Entry entry = stack[--stackIndex];
+                if (entry.dst >= closest.distance) continue;
+
+                if (entry.index & Node4::LEAF_FLAG) {
+                    const uint triangleIndex = entry.index & ~Node4::LEAF_FLAG;
+                    for (uint j=0; j<entry.count; j++) {
+                        intersect(bvh.allEdges[triangleIndex + j], triangleIndex + j, closest);
+                    }
+                    continue;
+                }
+
+                const Node4& node = bvh.allNodes[entry.index];
+                float dst[Node4::WIDTH];
+                distToBounds4(node, closest.distance, dst);
+
+                // Sort hit children by decreasing distance, so the closest one is popped first
+                Entry hits[Node4::WIDTH];
+                uint nbHits = 0;
+                for (uint i = 0; i < node.numChildren; i++) {
+                    if (dst[i] == INFINITY) continue;
+                    const Entry child = {node.child[i], node.count[i], dst[i]};
+                    uint j = nbHits++;
+                    while (j > 0 && hits[j-1].dst < child.dst) {
+                        hits[j] = hits[j-1];
+                        j--;
+                    }
+                    hits[j] = child;
+                }
+                for (uint i = 0; i < nbHits; i++) {
+                    stack[stackIndex++] = hits[i];
+                }
+            }
+            if (closest.distance < hit.getDistance()) {
+                hit.update(resolveHit(bvh.mesh, bvh.triangleIndices[closest.primitive], closest));
+            }
+        }
+
+        // Same order as rayTriangleBVH, each entry carries the decoded box of its node since quantized nodes only know their children
+        template <typename Q>
+        __host__ void rayTriangleQBVH(const QBVH<Q>& bvh, Hit& hit) {
+            if (bvh.allNodes.size() == 0 || distToBounds(bvh.rootBounds) >= hit.getDistance()) return;
+            TriangleHit closest;
+            closest.distance = hit.getDistance();
+
+            struct Entry {
+                uint index;
+                float dst;
+                Vector<float> boxMin, boxMax;
+            };
+            Entry stack[BVH::STACK_SIZE];
+            uint stackIndex = 0;
+            stack[stackIndex++] = {0, 0.f, bvh.rootBounds.getMin(), bvh.rootBounds.getMax()};
+
+            while (stackIndex > 0) {
+                const Entry entry = stack[--stackIndex];
+                if (entry.dst >= closest.distance) continue;
+
+                const QNode<Q>& node = bvh.allNodes[entry.index];
+                Vector<float> childMin[2], childMax[2];
+                node.decode(entry.boxMin, entry.boxMax, childMin, childMax);
+                const float dstA = distToBounds(childMin[0], childMax[0]);
+                const float dstB = distToBounds(childMin[1], childMax[1]);
+
+                // Leaf children are intersected right away, nearest first, interior ones are pushed farthest first
+                const float dst[2] = {dstA, dstB};
+                const uint order[2] = {dstA <= dstB ? 0u : 1u, dstA <= dstB ? 1u : 0u};
+                for (uint k = 0; k < 2; k++) {
+                    const uint i = order[k];
+                    if (!(node.child[i] & QNode<Q>::LEAF_FLAG) || dst[i] >= closest.distance) continue;
+                    const uint triangleIndex = node.child[i] & ~QNode<Q>::LEAF_FLAG;
+                    for (uint j = 0; j < node.count[i]; j++) {
+                        intersect(bvh.allEdges[triangleIndex + j], triangleIndex + j, closest);
+                    }
+                }
+                for (uint k = 2; k-- > 0;) {
+                    const uint i = order[k];
+                    if ((node.child[i] & QNode<Q>::LEAF_FLAG) || dst[i] >= closest.distance) continue;
+                    stack[stackIndex++] = {node.child[i], dst[i], childMin[i], childMax[i]};
+                }
+            }
+            if (closest.distance < hit.getDistance()) {
+                hit.update(resolveHit(bvh.mesh, bvh.triangleIndices[closest.primitive], closest));
+            }
         }
 };
\ No newline at end of file
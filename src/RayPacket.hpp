@@ -0,0 +1,291 @@
+#pragma once
+
+#include <cmath>
+
+#include "Ray.hpp"
+#include "BVH.hpp"
+#include "TLAS.hpp"
+#include "Hit.hpp"
+
+#if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+#include <immintrin.h>
+#endif
+
+/*
+Up to N coherent rays, e.g. the primary rays of a 4x4 pixel block for N = 16, traced together through the TLAS and the BVHs, CPU only.
+Rays are stored as SoA so that a box or a triangle is tested against 4 rays per SSE instruction.
+Traversal of a node stops at once when the interval bounds of the packet miss its box (frustum culling),
+otherwise the rays before the first one entering the box are left out of its whole subtree (ranged traversal).
+Every ray ends with the closest hit rayTriangleTLAS finds for it alone.
+*/
+template <uint N>
+class RayPacket {
+    static_assert(N % 4 == 0, "Rays go by groups of 4 lanes");
+
+    public:
+        static constexpr uint SIZE = N;
+        static constexpr uint WIDTH = N == 4 ? 2 : 4; // Of the block of pixels : 2x2, 4x2 or 4x4
+
+    private:
+        alignas(16) float ox[SIZE], oy[SIZE], oz[SIZE];
+        alignas(16) float dx[SIZE], dy[SIZE], dz[SIZE];
+        alignas(16) float ix[SIZE], iy[SIZE], iz[SIZE];
+        alignas(16) float t[SIZE], u[SIZE], v[SIZE];
+        uint primitive[SIZE];
+        uint bvhOf[SIZE];
+        Ray rays[SIZE];
+        uint numRays = 0;
+
+        // Interval bounds of the origins and inverse directions, frustum culling needs every direction component to keep its sign
+        float oMin[3], oMax[3], iMin[3], iMax[3];
+        bool coherent = false;
+        float tMax = INFINITY; // Farthest current hit of the packet
+
+        struct Entry {
+            uint index;
+            uint first; // Rays before it miss the node
+        };
+
+        __host__ static float Lower(const float plane, const float originMin, const float originMax, const float invMin, const float invMax) {
+            return Utils::min(Utils::min((plane - originMin)*invMin, (plane - originMin)*invMax), Utils::min((plane - originMax)*invMin, (plane - originMax)*invMax));
+        }
+
+        __host__ static float Upper(const float plane, const float originMin, const float originMax, const float invMin, const float invMax) {
+            return Utils::max(Utils::max((plane - originMin)*invMin, (plane - originMin)*invMax), Utils::max((plane - originMax)*invMin, (plane - originMax)*invMax));
+        }
+
+        // Conservative : true only if no ray of the packet can enter the box before the farthest current hit
+        __host__ bool frustumMisses(const Vector<float>& boxMin, const Vector<float>& boxMax) const {
+            if (!coherent) return false;
+            float tNear = 0.f, tFar = tMax;
+            for (uint k = 0; k < 3; k++) {
+                const bool positive = iMin[k] > 0;
+                const float nearPlane = positive ? boxMin[k] : boxMax[k];
+                const float farPlane = positive ? boxMax[k] : boxMin[k];
+                tNear = Utils::max(tNear, Lower(nearPlane, oMin[k], oMax[k], iMin[k], iMax[k]));
+                tFar = Utils::min(tFar, Upper(farPlane, oMin[k], oMax[k], iMin[k], iMax[k]));
+            }
+            return tNear > tFar;
+        }
+
+        // First ray from first on entering the box closer than its own hit, SIZE if none, with its distance to the box
+        __host__ uint firstHit(const Vector<float>& boxMin, const Vector<float>& boxMax, const uint first, float& dst) const {
+        #if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+            const __m128 minX = _mm_set1_ps(boxMin.getX()), minY = _mm_set1_ps(boxMin.getY()), minZ = _mm_set1_ps(boxMin.getZ());
+            const __m128 maxX = _mm_set1_ps(boxMax.getX()), maxY = _mm_set1_ps(boxMax.getY()), maxZ = _mm_set1_ps(boxMax.getZ());
+            for (uint g = first & ~3u; g < SIZE; g += 4) {
+                const __m128 px = _mm_load_ps(ox + g), py = _mm_load_ps(oy + g), pz = _mm_load_ps(oz + g);
+                const __m128 qx = _mm_load_ps(ix + g), qy = _mm_load_ps(iy + g), qz = _mm_load_ps(iz + g);
+                const __m128 t0x = _mm_mul_ps(_mm_sub_ps(minX, px), qx), t1x = _mm_mul_ps(_mm_sub_ps(maxX, px), qx);
+                const __m128 t0y = _mm_mul_ps(_mm_sub_ps(minY, py), qy), t1y = _mm_mul_ps(_mm_sub_ps(maxY, py), qy);
+                const __m128 t0z = _mm_mul_ps(_mm_sub_ps(minZ, pz), qz), t1z = _mm_mul_ps(_mm_sub_ps(maxZ, pz), qz);
+                const __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+                const __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_load_ps(t + g)));
+                int mask = _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(tNear, tFar), _mm_cmpgt_ps(tFar, _mm_setzero_ps())));
+                mask &= g < first ? ~0u << (first - g) : ~0u;
+                if (mask != 0) {
+                    const uint lane = __builtin_ctz(mask);
+                    alignas(16) float near[4];
+                    _mm_store_ps(near, tNear);
+                    dst = near[lane];
+                    return g + lane;
+                }
+            }
+        #else
+            for (uint i = first; i < SIZE; i++) {
+                const float d = rays[i].distToBounds(boxMin, boxMax);
+                if (d < t[i]) {
+                    dst = d;
+                    return i;
+                }
+            }
+        #endif
+            return SIZE;
+        }
+
+        // Ray::intersect for the rays from first on
+        __host__ void intersect(const TriangleEdges& tri, const uint prim, const uint bvhIndex, const uint first) {
+        #if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+            const __m128 nx = _mm_set1_ps(tri.normal.getX()), ny = _mm_set1_ps(tri.normal.getY()), nz = _mm_set1_ps(tri.normal.getZ());
+            const __m128 ax = _mm_set1_ps(tri.vertex0.getX()), ay = _mm_set1_ps(tri.vertex0.getY()), az = _mm_set1_ps(tri.vertex0.getZ());
+            const __m128 bx = _mm_set1_ps(tri.edgeAB.getX()), by = _mm_set1_ps(tri.edgeAB.getY()), bz = _mm_set1_ps(tri.edgeAB.getZ());
+            const __m128 cx = _mm_set1_ps(tri.edgeAC.getX()), cy = _mm_set1_ps(tri.edgeAC.getY()), cz = _mm_set1_ps(tri.edgeAC.getZ());
+            const __m128 eps = _mm_set1_ps(1E-8f), one = _mm_set1_ps(1.f);
+            const __m128 signMask = _mm_set1_ps(-0.f);
+            for (uint g = first & ~3u; g < SIZE; g += 4) {
+                const __m128 rx = _mm_load_ps(dx + g), ry = _mm_load_ps(dy + g), rz = _mm_load_ps(dz + g);
+                const __m128 determinant = _mm_xor_ps(signMask, _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, nx), _mm_mul_ps(ry, ny)), _mm_mul_ps(rz, nz)));
+                __m128 valid = _mm_cmpge_ps(_mm_andnot_ps(signMask, determinant), eps);
+                const __m128 invDet = _mm_div_ps(one, determinant);
+
+                const __m128 aox = _mm_sub_ps(_mm_load_ps(ox + g), ax), aoy = _mm_sub_ps(_mm_load_ps(oy + g), ay), aoz = _mm_sub_ps(_mm_load_ps(oz + g), az);
+                const __m128 dst = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(aox, nx), _mm_mul_ps(aoy, ny)), _mm_mul_ps(aoz, nz)), invDet);
+                const __m128 tCurrent = _mm_load_ps(t + g);
+                valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(dst, eps), _mm_cmplt_ps(dst, tCurrent)));
+                if (_mm_movemask_ps(valid) == 0) continue;
+
+                // ao x direction
+                const __m128 daox = _mm_sub_ps(_mm_mul_ps(aoy, rz), _mm_mul_ps(aoz, ry));
+                const __m128 daoy = _mm_sub_ps(_mm_mul_ps(aoz, rx), _mm_mul_ps(aox, rz));
+                const __m128 daoz = _mm_sub_ps(_mm_mul_ps(aox, ry), _mm_mul_ps(aoy, rx));
+                const __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, daox), _mm_mul_ps(cy, daoy)), _mm_mul_ps(cz, daoz)), invDet);
+                const __m128 vv = _mm_xor_ps(signMask, _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(bx, daox), _mm_mul_ps(by, daoy)), _mm_mul_ps(bz, daoz)), invDet));
+                valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(uu, eps), _mm_cmpge_ps(vv, eps)));
+                valid = _mm_and_ps(valid, _mm_cmpge_ps(_mm_sub_ps(_mm_sub_ps(one, uu), vv), eps));
+                const int mask = _mm_movemask_ps(valid);
+                if (mask == 0) continue;
+
+                _mm_store_ps(t + g, _mm_or_ps(_mm_and_ps(valid, dst), _mm_andnot_ps(valid, tCurrent)));
+                _mm_store_ps(u + g, _mm_or_ps(_mm_and_ps(valid, uu), _mm_andnot_ps(valid, _mm_load_ps(u + g))));
+                _mm_store_ps(v + g, _mm_or_ps(_mm_and_ps(valid, vv), _mm_andnot_ps(valid, _mm_load_ps(v + g))));
+                for (uint lane = 0; lane < 4; lane++) {
+                    if (mask & (1 << lane)) {
+                        primitive[g + lane] = prim;
+                        bvhOf[g + lane] = bvhIndex;
+                    }
+                }
+            }
+        #else
+            for (uint i = first; i < SIZE; i++) {
+                TriangleHit closest;
+                closest.distance = t[i];
+                if (rays[i].intersect(tri, prim, closest)) {
+                    t[i] = closest.distance;
+                    u[i] = closest.u;
+                    v[i] = closest.v;
+                    primitive[i] = prim;
+                    bvhOf[i] = bvhIndex;
+                }
+            }
+        #endif
+        }
+
+        __host__ void updateTMax() {
+            tMax = t[0];
+            for (uint i = 1; i < SIZE; i++) {
+                tMax = Utils::max(tMax, t[i]);
+            }
+        }
+
+        // Nearer child popped first, by the distance of the first ray entering each of them
+        __host__ void pushChildren(const Array<Node>& nodes, const uint childIndex, const uint first, Entry* stack, uint& stackIndex) const {
+            Entry entries[2];
+            float dst[2];
+            uint nbHits = 0;
+            for (uint i = 0; i < 2; i++) {
+                const Node& child = nodes[childIndex + i];
+                if (frustumMisses(child.getMin(), child.getMax())) continue;
+                const uint childFirst = firstHit(child.getMin(), child.getMax(), first, dst[nbHits]);
+                if (childFirst < SIZE) entries[nbHits++] = {childIndex + i, childFirst};
+            }
+            if (nbHits == 2) {
+                const bool swap = entries[1].first < entries[0].first || (entries[1].first == entries[0].first && dst[1] < dst[0]);
+                stack[stackIndex++] = entries[swap ? 0 : 1];
+                stack[stackIndex++] = entries[swap ? 1 : 0];
+            } else if (nbHits == 1) {
+                stack[stackIndex++] = entries[0];
+            }
+        }
+
+        __host__ void traceBVH(const BVH& bvh, const uint bvhIndex, const uint first) {
+            if (bvh.allNodes.size() == 0) return;
+            Entry stack[BVH::STACK_SIZE];
+            uint stackIndex = 0;
+            stack[stackIndex++] = {0, first};
+            while (stackIndex > 0) {
+                const Entry entry = stack[--stackIndex];
+                // Lazy build : the first packet entering a pending node splits it
+                if (bvh.allNodes[entry.index].isPending()) bvh.expand(entry.index);
+                const Node& node = bvh.allNodes[entry.index];
+                if (node.isLeaf()) {
+                    for (uint j = 0; j < node.getTriangleCount(); j++) {
+                        const uint prim = node.getTriangleIndex() + j;
+                        intersect(bvh.allEdges[prim], prim, bvhIndex, entry.first);
+                    }
+                    updateTMax();
+                } else {
+                    pushChildren(bvh.allNodes, node.getChildIndex(), entry.first, stack, stackIndex);
+                }
+            }
+        }
+
+    public:
+        __host__ RayPacket() {};
+
+        // Rays past the given ones repeat the first, their results are never read
+        __host__ RayPacket(const Ray* packetRays, const uint count) : numRays(count) {
+            coherent = true;
+            for (uint k = 0; k < 3; k++) {
+                oMin[k] = iMin[k] = INFINITY;
+                oMax[k] = iMax[k] = -INFINITY;
+            }
+            for (uint i = 0; i < SIZE; i++) {
+                const Ray& ray = packetRays[i < count ? i : 0];
+                rays[i] = ray;
+                const Vector<float> origin = ray.getPoint();
+                const Vector<float> direction = ray.getDirection();
+                const Vector<float> invDir = ray.getInvDir();
+                ox[i] = origin.getX(); oy[i] = origin.getY(); oz[i] = origin.getZ();
+                dx[i] = direction.getX(); dy[i] = direction.getY(); dz[i] = direction.getZ();
+                ix[i] = invDir.getX(); iy[i] = invDir.getY(); iz[i] = invDir.getZ();
+                t[i] = INFINITY;
+                u[i] = v[i] = 0.f;
+                primitive[i] = bvhOf[i] = 0;
+                for (uint k = 0; k < 3; k++) {
+                    oMin[k] = Utils::min(oMin[k], origin[k]);
+                    oMax[k] = Utils::max(oMax[k], origin[k]);
+                    iMin[k] = Utils::min(iMin[k], invDir[k]);
+                    iMax[k] = Utils::max(iMax[k], invDir[k]);
+                }
+            }
+            for (uint k = 0; k < 3; k++) {
+                coherent = coherent && std::isfinite(iMin[k]) && std::isfinite(iMax[k]) && (iMin[k] > 0 || iMax[k] < 0);
+            }
+        };
+
+        __host__ uint size() const {
+            return numRays;
+        }
+
+        // Closest hits through the TLAS, as rayTriangleTLAS for every ray
+        __host__ void trace(const TLAS& tlas, const Array<BVH>& bvhs) {
+            if (tlas.allNodes.size() == 0) return;
+            Entry stack[TLAS::STACK_SIZE];
+            uint stackIndex = 0;
+            float dst;
+            const Node& root = tlas.allNodes[0];
+            if (frustumMisses(root.getMin(), root.getMax())) return;
+            const uint first = firstHit(root.getMin(), root.getMax(), 0, dst);
+            if (first == SIZE) return;
+            stack[stackIndex++] = {0, first};
+            while (stackIndex > 0) {
+                const Entry entry = stack[--stackIndex];
+                const Node& node = tlas.allNodes[entry.index];
+                if (node.isLeaf()) {
+                    for (uint j = 0; j < node.getTriangleCount(); j++) {
+                        const uint bvhIndex = tlas.bvhIndices[node.getTriangleIndex() + j];
+                        traceBVH(bvhs[bvhIndex], bvhIndex, entry.first);
+                    }
+                } else {
+                    pushChildren(tlas.allNodes, node.getChildIndex(), entry.first, stack, stackIndex);
+                }
+            }
+        }
+
+        __host__ bool hasHit(const uint i) const {
+            return t[i] < INFINITY;
+        }
+
+        __host__ Hit getHit(const uint i, const Array<BVH>& bvhs) const {
+            Hit hit = Hit();
+            if (!hasHit(i)) return hit;
+            const BVH& bvh = bvhs[bvhOf[i]];
+            const TriangleHit closest = {t[i], u[i], v[i], primitive[i]};
+            hit.update(rays[i].resolveHit(bvh.mesh, bvh.triangleIndices[closest.primitive], closest));
+            return hit;
+        }
+};
+
+using RayPacket4 = RayPacket<4>;
+using RayPacket8 = RayPacket<8>;
+using RayPacket16 = RayPacket<16>;
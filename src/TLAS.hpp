@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "BVH.hpp"
+#include "utils/Array.hpp"
+
+#include "utils/cuda_ready.hpp"
+
+/*
+Top level acceleration structure : a BVH whose leaves reference whole BVHs (one per mesh) instead of triangles.
+Leaves reuse Node, with triangleIndex/triangleCount addressing a range of bvhIndices.
+*/
+class TLAS : public CudaReady {
+    private:
+        struct Instance {
+            BoundingBox bounds;
+            Vector<float> center;
+            uint bvhIndex;
+        };
+
+        __host__ void split(std::vector<Instance>& instances, const uint parentIndex, const uint start, const uint count, const uint depth) {
+            if (count <= 1 || depth >= MAX_DEPTH) {
+                makeLeaf(instances, parentIndex, start, count);
+                return;
+            }
+
+            BoundingBox centroidBounds;
+            for (uint i = start; i < start + count; i++) {
+                centroidBounds.growToInclude(instances[i].center);
+            }
+            const Vector<float> extent = centroidBounds.getSize();
+            uint axis = 0;
+            if (extent.getY() > extent.getX()) axis = 1;
+            if (extent.getZ() > Utils::max(extent.getX(), extent.getY())) axis = 2;
+
+            std::sort(instances.begin() + start, instances.begin() + start + count, [axis](const Instance& a, const Instance& b) {
+                return a.center[axis] < b.center[axis];
+            });
+
+            // Exact SAH sweep, mesh counts are small enough to afford it
+            std::vector<float> rightCost(count);
+            BoundingBox rightBounds;
+            for (uint i = count - 1; i > 0; i--) {
+                rightBounds.growToInclude(instances[start + i].bounds.getMin(), instances[start + i].bounds.getMax());
+                rightCost[i] = BVH::HalfArea(rightBounds) * (count - i);
+            }
+
+            float bestCost = INFINITY;
+            uint bestSplit = count / 2;
+            BoundingBox leftBounds;
+            for (uint i = 1; i < count; i++) {
+                leftBounds.growToInclude(instances[start + i - 1].bounds.getMin(), instances[start + i - 1].bounds.getMax());
+                const float cost = BVH::HalfArea(leftBounds) * i + rightCost[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = i;
+                }
+            }
+
+            Node childA = Node();
+            Node childB = Node();
+            for (uint i = start; i < start + bestSplit; i++) {
+                childA.addToBoundingBox(instances[i].bounds);
+            }
+            for (uint i = start + bestSplit; i < start + count; i++) {
+                childB.addToBoundingBox(instances[i].bounds);
+            }
+
+            const uint childIndexLeft = allNodes.push_back(childA);
+            const uint childIndexRight = allNodes.push_back(childB);
+            allNodes[parentIndex].setChildIndex(childIndexLeft);
+
+            split(instances, childIndexLeft, start, bestSplit, depth + 1);
+            split(instances, childIndexRight, start + bestSplit, count - bestSplit, depth + 1);
+        }
+
+        __host__ void makeLeaf(const std::vector<Instance>& instances, const uint nodeIndex, const uint start, const uint count) {
+            allNodes[nodeIndex].setTriangleIndex(bvhIndices.size());
+            allNodes[nodeIndex].setTriangleCount(count);
+            for (uint i = start; i < start + count; i++) {
+                bvhIndices.push_back(instances[i].bvhIndex);
+            }
+        }
+
+    public:
+        static constexpr uint STACK_SIZE = 64; // Traversal stacks of the TLAS, in Ray and RayPacket
+        static constexpr uint MAX_DEPTH = STACK_SIZE - 1; // A traversal holds at most depth + 1 nodes, deeper instances share a leaf
+
+        Array<Node> allNodes;
+        Array<uint> bvhIndices;
+
+        __host__ TLAS() {};
+        __host__ TLAS(const Array<BVH>& bvhs) {
+            std::vector<Instance> instances;
+            BoundingBox bounds;
+            for (uint i = 0; i < bvhs.size(); i++) {
+                const BVH bvh = bvhs[i];
+                if (bvh.allNodes.size() == 0) continue;
+                const BoundingBox meshBounds = bvh.allNodes[0].getBoundingBox();
+                instances.push_back({meshBounds, meshBounds.getCenter(), i});
+                bounds.growToInclude(meshBounds.getMin(), meshBounds.getMax());
+            }
+            if (instances.empty()) return;
+
+            allNodes.push_back(Node(bounds));
+            allNodes.push_back(Node(0u)); // Padding (empty leaf), keeps sibling pairs cache line aligned
+            split(instances, 0, 0, instances.size(), 0);
+        };
+
+        __host__ void cuda() override {
+            allNodes.cuda();
+            bvhIndices.cuda();
+        }
+
+        __host__ void cpu() override {
+            allNodes.cpu();
+            bvhIndices.cpu();
+        }
+
+        __host__ void sync_to_cpu() override {
+            allNodes.sync_to_cpu();
+            bvhIndices.sync_to_cpu();
+        }
+
+        __host__ void free() override {
+            allNodes.free();
+            bvhIndices.free();
+        }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Ray.hpp"
+#include "utils/Sampler.hpp"
 
 namespace Tracing {
 
@@ -10,27 +11,58 @@ namespace Tracing {
         }
     }
 
-    __host__ static Hit simpleTraceHost(Ray& ray, const Meshes& meshes) {
-        Hit finalHit;
+    __host__ __device__ static void rayTriangleBVHs(Ray& ray, const TLAS& tlas, const Array<BVH>& bvhs, Hit& hit) {
+        ray.rayTriangleTLAS(tlas, bvhs, hit);
+    }
+
+    // Shadow / visibility query : is anything hit before tMax along the ray
+    __host__ __device__ static bool occluded(const Ray& ray, const Array<BVH>& bvhs, const float tMax = INFINITY) {
+        for (uint i = 0; i<bvhs.size(); i++) {
+            if (ray.occludedBVH(bvhs[i], tMax)) return true;
+        }
+        return false;
+    }
+
+    __host__ __device__ static bool occluded(const Ray& ray, const TLAS& tlas, const Array<BVH>& bvhs, const float tMax = INFINITY) {
+        return ray.occludedTLAS(tlas, bvhs, tMax);
+    }
+
+    __host__ static void rayTriangleBVHs(Ray& ray, const Array<BVH4>& bvhs, Hit& hit) {
+        for (uint i = 0; i<bvhs.size(); i++) {
+            ray.rayTriangleBVH4(bvhs[i], hit);
+        }
+    }
+
+    template <typename Q>
+    __host__ static void rayTriangleBVHs(Ray& ray, const Array<QBVH<Q>>& bvhs, Hit& hit) {
+        for (uint i = 0; i<bvhs.size(); i++) {
+            ray.rayTriangleQBVH(bvhs[i], hit);
+        }
+    }
+
+    __host__ static Hit simpleTraceHost(Ray& ray, const Array<IndexedMesh>& meshes) {
+        TriangleHit closest;
+        uint closestMesh = 0;
         for (int i=0;i<meshes.size();i++) {
             for (int j=0; j<meshes[i].size(); j++) {
-                Hit hit = ray.rayTriangle(meshes[i][j]);
-                finalHit.update(hit);
+                if (ray.intersect(meshes[i].getEdges(j), j, closest))
+                    closestMesh = i;
             }
         }
-        return finalHit;
+        if (closest.distance == INFINITY) return Hit();
+        return ray.resolveHit(meshes[closestMesh], closest.primitive, closest);
     }
 
     __device__ static Hit simpleTraceDevice(Ray& ray, Triangle* triangles, const uint nbTriangles) {
-        Hit finalHit;
+        TriangleHit closest;
         for (int i=0;i<nbTriangles;i++) {
-            Hit hit = ray.rayTriangle(triangles[i]);
-            finalHit.update(hit);
+            ray.intersect(triangles[i].getEdges(), i, closest);
         }
-        return finalHit;
+        if (closest.distance == INFINITY) return Hit();
+        return ray.resolveHit(triangles[closest.primitive], closest);
     }
 
-    __host__ static Pixel simpleRayTraceHost(Ray& ray, Meshes& meshes, const Pixel& backgroundColor) {
+    __host__ static Pixel simpleRayTraceHost(Ray& ray, const Array<IndexedMesh>& meshes, const Pixel& backgroundColor) {
         Hit hit = simpleTraceHost(ray, meshes);
         if (hit.getHasHit())
             return hit.getMaterial().getColor();
@@ -38,13 +70,15 @@ namespace Tracing {
             return backgroundColor;
     }
 
-    __host__ static Pixel rayTraceHost(Ray& ray, Meshes& meshes, uint state) {
+    // Random numbers of the path by (pixel, sample, bounce), see Sampler
+    __host__ static Pixel rayTraceHost(Ray& ray, const Array<IndexedMesh>& meshes, const Sampler& sampler, const uint pixel, const uint sample) {
         Vector<float> incomingLight = Vector<float>();
         Vector<float> rayColor = Vector<float>(1.,1.,1.);
         for (int bounce=0;bounce<ray.getMaxBounce();bounce++) {
             Hit hit = simpleTraceHost(ray, meshes);
             if (hit.getHasHit()) {
-                ray.updateRay(hit, state);
+                RandomGenerator random = sampler.bounce(pixel, sample, bounce);
+                ray.updateRay(hit, random);
                 ray.updateLight(hit, &incomingLight, &rayColor);
                 //const float p = rayColor.max();
                 //if (random_gen.randomValue(state) >= p) {
@@ -59,13 +93,14 @@ namespace Tracing {
         return Pixel(incomingLight);
     }
 
-    __device__ static Vector<float> rayTraceDevice(uint state, Ray& ray, Triangle* triangles, uint nbTriangles) {
+    __device__ static Vector<float> rayTraceDevice(const Sampler& sampler, const uint pixel, const uint sample, Ray& ray, Triangle* triangles, uint nbTriangles) {
         Vector<float> incomingLight = Vector<float>();
         Vector<float> rayColor = Vector<float>(1.,1.,1.);
         for (int bounce=0;bounce<ray.getMaxBounce();bounce++) {
             Hit hit = simpleTraceDevice(ray, triangles, nbTriangles);
             if (hit.getHasHit()) {
-                ray.updateRay(hit, state);
+                RandomGenerator random = sampler.bounce(pixel, sample, bounce);
+                ray.updateRay(hit, random);
                 ray.updateLight(hit, &incomingLight, &rayColor);
                 //const float p = rayColor.max();
                 //if (random_gen.randomValue(uidx) >= p) {
@@ -80,14 +115,15 @@ namespace Tracing {
         return incomingLight;
     }
 
-    __host__ static Pixel rayTraceBVHHost(Ray& ray, const Array<BVH>& bvhs, uint state) {
+    __host__ static Pixel rayTraceBVHHost(Ray& ray, const TLAS& tlas, const Array<BVH>& bvhs, const Sampler& sampler, const uint pixel, const uint sample) {
         Vector<float> incomingLight = Vector<float>();
         Vector<float> rayColor = Vector<float>(1.,1.,1.);
         for (int bounce=0;bounce<ray.getMaxBounce();bounce++) {
             Hit hit = Hit();
-            rayTriangleBVHs(ray, bvhs, hit);
+            rayTriangleBVHs(ray, tlas, bvhs, hit);
             if (hit.getHasHit()) {
-                ray.updateRay(hit, state);
+                RandomGenerator random = sampler.bounce(pixel, sample, bounce);
+                ray.updateRay(hit, random);
                 ray.updateLight(hit, &incomingLight, &rayColor);
                 //const float p = rayColor.max();
                 //if (random_gen.randomValue(state) >= p) {
@@ -102,14 +138,15 @@ namespace Tracing {
         return Pixel(incomingLight);
     }
 
-    __device__ static Vector<float> rayTraceBVHDevice(uint state, Ray& ray, Array<BVH>& bvhs) {
+    __device__ static Vector<float> rayTraceBVHDevice(const Sampler& sampler, const uint pixel, const uint sample, Ray& ray, const TLAS& tlas, Array<BVH>& bvhs) {
         Vector<float> incomingLight = Vector<float>();
         Vector<float> rayColor = Vector<float>(1.,1.,1.);
         for (int bounce=0;bounce<ray.getMaxBounce();bounce++) {
             Hit hit = Hit();
-            rayTriangleBVHs(ray, bvhs, hit);
+            rayTriangleBVHs(ray, tlas, bvhs, hit);
             if (hit.getHasHit()) {
-                ray.updateRay(hit, state);
+                RandomGenerator random = sampler.bounce(pixel, sample, bounce);
+                ray.updateRay(hit, random);
                 ray.updateLight(hit, &incomingLight, &rayColor);
                 
                 //const float p = rayColor.max();
@@ -125,10 +162,10 @@ namespace Tracing {
         return incomingLight;
     }
 
-    __device__ static Vector<float> rasterizeBVHDevice(Ray& ray, Array<BVH> bvhs) {
+    __device__ static Vector<float> rasterizeBVHDevice(Ray& ray, const TLAS& tlas, Array<BVH> bvhs) {
         Vector<float> incomingLight = Vector<float>();
         Hit hit = Hit();
-        rayTriangleBVHs(ray, bvhs, hit);
+        rayTriangleBVHs(ray, tlas, bvhs, hit);
         /*
         while (!hit.getHasHit() || hit.getMaterial().getSpecularProb() > 0) {
             ray.updateRay(hit, 0);
@@ -5,11 +5,40 @@
 #include "Line.hpp"
 #include "Material.hpp"
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
+#include "utils/Simd.hpp"
 
 #include <vector>
 #include <cmath>
 
+// Only what the intersection test needs, precomputed once the BVH order is known
+struct TriangleEdges {
+    Vector<float> vertex0;
+    Vector<float> edgeAB;
+    Vector<float> edgeAC;
+    Vector<float> normal; // Not normalized, edgeAB x edgeAC
+};
+
+// Up to WIDTH consecutive triangles of a leaf as SoA, so that the CPU tests a ray against all of them at once.
+// Unused lanes are zero, a degenerate triangle no ray hits
+struct alignas(32) TriangleBlock {
+    static constexpr uint WIDTH = Simd::WIDTH;
+
+    float vertex0[3][WIDTH];
+    float edgeAB[3][WIDTH];
+    float edgeAC[3][WIDTH];
+    float normal[3][WIDTH];
+
+    __host__ void set(const uint lane, const TriangleEdges& tri) {
+        for (uint axis = 0; axis < 3; axis++) {
+            vertex0[axis][lane] = tri.vertex0[axis];
+            edgeAB[axis][lane] = tri.edgeAB[axis];
+            edgeAC[axis][lane] = tri.edgeAC[axis];
+            normal[axis][lane] = tri.normal[axis];
+        }
+    }
+};
+
 class Triangle {
 
     private:
@@ -126,6 +155,12 @@ class Triangle {
             return (normal0*dists[0] + normal1*dists[1] + normal2*dists[2]).normalize();
         }
 
+        __host__ __device__ TriangleEdges getEdges() const {
+            const Vector<float> edgeAB = vertex1 - vertex0;
+            const Vector<float> edgeAC = vertex2 - vertex0;
+            return {vertex0, edgeAB, edgeAC, edgeAB.crossProduct(edgeAC)};
+        }
+
         __host__ __device__ Vector<float> getBarycenter() const {
             return (vertex0 + vertex1 + vertex2)/3;
         }
@@ -5,7 +5,7 @@
 
 #include "utils/MinMax.hpp"
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
 
 template<typename T>
 class Vector {
@@ -50,7 +50,7 @@ class Vector {
             return 3;
         }
 
-        __host__ __device__ T operator[](const uint i) {
+        __host__ __device__ T operator[](const uint i) const {
             switch (i) {
                 case 0:
                     return x;
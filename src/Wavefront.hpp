@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+#include "Camera.hpp"
+#include "Ray.hpp"
+#include "TLAS.hpp"
+#include "Tracing.hpp"
+#include "RayPacket.hpp"
+#include "utils/Sampler.hpp"
+
+/*
+Wavefront path tracing on the host : the paths of a batch of pixels live in SoA buffers and every bounce goes through distinct stages,
+each one a loop over the whole queue, instead of one path at a time from the camera to the last bounce (Tracing::rayTraceBVHHost).
+    generate -> (extend -> shade -> compact) until no path is left
+extend only traverses, shade samples the new directions then updates light and throughput in a float loop the compiler vectorizes,
+compact drops finished paths so that later bounces run over dense arrays.
+Camera rays are generated by blocks of 4x4 pixels and their first extend traces them as RayPacket16.
+Paths follow the same rules as rayTraceBVHHost : a miss adds the environment light, nothing is added after the last bounce,
+and they draw the same numbers from the Sampler, by pixel, sample and bounce.
+One instance per thread, buffers are kept from one batch to the next.
+*/
+class Wavefront {
+    private:
+        static constexpr float ENV_REFRACTIVE_INDEX = 1.000293f;
+
+        uint numPaths = 0;
+
+        // Paths, the first numPaths slots are alive
+        std::vector<float> originX, originY, originZ;
+        std::vector<float> dirX, dirY, dirZ;
+        std::vector<float> throughputR, throughputG, throughputB;
+        std::vector<float> lightR, lightG, lightB; // Radiance gathered by the path so far
+        std::vector<uint> pixel; // In the batch
+        std::vector<uint> sample; // Of the pixel
+        std::vector<uint8_t> inside;
+
+        // Closest hit of each path, written by extend
+        std::vector<float> hitT; // INFINITY on a miss
+        std::vector<float> pointX, pointY, pointZ;
+        std::vector<float> normalX, normalY, normalZ;
+        std::vector<float> colorR, colorG, colorB, emission;
+        std::vector<float> pdf; // Of the direction drawn by shade
+        std::vector<Material> materials;
+
+        // Per pixel of the batch
+        std::vector<float> radianceR, radianceG, radianceB;
+        uint samplesPerPixel = 1;
+        uint batchX = 0, batchY = 0, batchWidth = 0, imageWidth = 0;
+        const Sampler* sampler = nullptr; // Of the batch
+
+        size_t numExtended = 0;
+
+        void reserve(const uint capacity) {
+            for (std::vector<float>* buffer : {&originX, &originY, &originZ, &dirX, &dirY, &dirZ, &throughputR, &throughputG, &throughputB,
+                    &lightR, &lightG, &lightB, &hitT, &pointX, &pointY, &pointZ, &normalX, &normalY, &normalZ, &colorR, &colorG, &colorB, &emission, &pdf}) {
+                buffer->resize(capacity);
+            }
+            pixel.resize(capacity);
+            sample.resize(capacity);
+            inside.resize(capacity);
+            materials.resize(capacity);
+        }
+
+        using Packet = RayPacket16;
+
+        // Camera rays of the width*height pixels from (x0, y0), placed in their pixel by the sampler.
+        // Consecutive paths are the same sample of the pixels of a packet block, so that the first extend traces them together
+        void generate(const Camera& cam, const uint x0, const uint y0, const uint width, const uint height, const uint samples) {
+            samplesPerPixel = samples;
+            batchX = x0; batchY = y0; batchWidth = width; imageWidth = cam.getWidth();
+            numPaths = width*height*samplesPerPixel;
+            if (originX.size() < numPaths) reserve(numPaths);
+            radianceR.assign(width*height, 0.f);
+            radianceG.assign(width*height, 0.f);
+            radianceB.assign(width*height, 0.f);
+
+            const Vector<float> origin = cam.getPosition();
+            const Vector<float> front = cam.getVectFront()*cam.getFov();
+            const uint blockW = Packet::WIDTH, blockH = Packet::SIZE / Packet::WIDTH;
+            uint i = 0;
+            for (uint by = 0; by < height; by += blockH) {
+                for (uint bx = 0; bx < width; bx += blockW) {
+                    for (uint s = 0; s < samplesPerPixel; s++) {
+                        for (uint y = by; y < Utils::min(by + blockH, height); y++) {
+                            for (uint x = bx; x < Utils::min(bx + blockW, width); x++, i++) {
+                                float dx, dy;
+                                sampler->pixelOffset((y0 + y)*imageWidth + x0 + x, s, dx, dy);
+                                const Vector<float> direction = (front + cam.getPixelCoordOnCapt(x0 + x + dx, y0 + y + dy)).normalize();
+                                originX[i] = origin.getX(); originY[i] = origin.getY(); originZ[i] = origin.getZ();
+                                dirX[i] = direction.getX(); dirY[i] = direction.getY(); dirZ[i] = direction.getZ();
+                                pixel[i] = y*width + x;
+                                sample[i] = s;
+                                inside[i] = false;
+                            }
+                        }
+                    }
+                }
+            }
+            std::fill_n(throughputR.begin(), numPaths, 1.f);
+            std::fill_n(throughputG.begin(), numPaths, 1.f);
+            std::fill_n(throughputB.begin(), numPaths, 1.f);
+            std::fill_n(lightR.begin(), numPaths, 0.f);
+            std::fill_n(lightG.begin(), numPaths, 0.f);
+            std::fill_n(lightB.begin(), numPaths, 0.f);
+        }
+
+        Ray pathRay(const uint i) const {
+            return Ray(Vector<float>(originX[i], originY[i], originZ[i]), Vector<float>(dirX[i], dirY[i], dirZ[i]));
+        }
+
+        // Closest hit of every alive path, camera rays go by packets while secondary rays are too incoherent for them
+        void extend(const TLAS& tlas, const Array<BVH>& bvhs, const bool primary) {
+            if (primary) {
+                for (uint i = 0; i < numPaths; i += Packet::SIZE) {
+                    const uint count = Utils::min(Packet::SIZE, numPaths - i);
+                    Ray rays[Packet::SIZE];
+                    for (uint j = 0; j < count; j++) {
+                        rays[j] = pathRay(i + j);
+                    }
+                    Packet packet = Packet(rays, count);
+                    packet.trace(tlas, bvhs);
+                    for (uint j = 0; j < count; j++) {
+                        storeHit(i + j, packet.getHit(j, bvhs));
+                    }
+                }
+            } else {
+                for (uint i = 0; i < numPaths; i++) {
+                    Ray ray = pathRay(i);
+                    Hit hit = Hit();
+                    Tracing::rayTriangleBVHs(ray, tlas, bvhs, hit);
+                    storeHit(i, hit);
+                }
+            }
+            numExtended += numPaths;
+        }
+
+        void storeHit(const uint i, const Hit& hit) {
+            if (!hit.getHasHit()) {
+                hitT[i] = INFINITY;
+                normalX[i] = 0.f; normalY[i] = 0.f; normalZ[i] = 0.f;
+                colorR[i] = 0.f; colorG[i] = 0.f; colorB[i] = 0.f;
+                emission[i] = 0.f;
+                return;
+            }
+            const Vector<float> point = hit.getPoint();
+            const Vector<float> normal = hit.getNormal();
+            const Material& material = hit.getMaterial();
+            const Vector<float> color = material.getColor().toVector();
+            hitT[i] = hit.getDistance();
+            pointX[i] = point.getX(); pointY[i] = point.getY(); pointZ[i] = point.getZ();
+            normalX[i] = normal.getX(); normalY[i] = normal.getY(); normalZ[i] = normal.getZ();
+            colorR[i] = color.getX(); colorG[i] = color.getY(); colorB[i] = color.getZ();
+            emission[i] = material.getEmissionStrengh();
+            materials[i] = material;
+        }
+
+        void shade(const uint bounce) {
+            // Next direction of the paths that hit, the only per material branching
+            for (uint i = 0; i < numPaths; i++) {
+                if (hitT[i] == INFINITY) {
+                    pdf[i] = 1.f;
+                    continue;
+                }
+                RayInfo info = {ENV_REFRACTIVE_INDEX, inside[i] != 0};
+                const uint imagePixel = (batchY + pixel[i] / batchWidth)*imageWidth + batchX + pixel[i] % batchWidth;
+                RandomGenerator random = sampler->bounce(imagePixel, sample[i], bounce);
+                // The incoming direction as the Ray holds it, normalized again : reflections then match rayTraceBVHHost to the bit
+                const Vector<float> direction = materials[i].trace(pathRay(i).getDirection(),
+                    Vector<float>(normalX[i], normalY[i], normalZ[i]), info, random);
+                inside[i] = info.isInside;
+                pdf[i] = info.pdf;
+                originX[i] = pointX[i]; originY[i] = pointY[i]; originZ[i] = pointZ[i];
+                dirX[i] = direction.getX(); dirY[i] = direction.getY(); dirZ[i] = direction.getZ();
+            }
+            // Material::shade along the new direction, and the environment light on a miss, without branches.
+            // Raw pointers and omp simd : with 18 arrays, 6 of them written, the compiler gives up on checking their overlap at run time and keeps the loop scalar
+            const float* t = hitT.data();
+            const float *nx = normalX.data(), *ny = normalY.data(), *nz = normalZ.data();
+            const float *dx = dirX.data(), *dy = dirY.data(), *dz = dirZ.data();
+            const float *r = colorR.data(), *g = colorG.data(), *b = colorB.data(), *e = emission.data(), *p = pdf.data();
+            float *lr = lightR.data(), *lg = lightG.data(), *lb = lightB.data();
+            float *tr = throughputR.data(), *tg = throughputG.data(), *tb = throughputB.data();
+            const uint n = numPaths;
+            #pragma omp simd
+            for (uint i = 0; i < n; i++) {
+                const float miss = t[i] == INFINITY ? 1.f : 0.f;
+                const float weight = (nx[i]*dx[i] + ny[i]*dy[i] + nz[i]*dz[i]) / (Sampling::Pi * p[i]);
+                lr[i] += tr[i] * (r[i]*e[i] + miss);
+                lg[i] += tg[i] * (g[i]*e[i] + miss);
+                lb[i] += tb[i] * (b[i]*e[i] + miss);
+                tr[i] *= r[i]*weight;
+                tg[i] *= g[i]*weight;
+                tb[i] *= b[i]*weight;
+            }
+        }
+
+        // Hands the light of finished paths to their pixel and packs the others at the front, in order
+        void compact(const bool lastBounce) {
+            uint alive = 0;
+            for (uint i = 0; i < numPaths; i++) {
+                if (lastBounce || hitT[i] == INFINITY) {
+                    radianceR[pixel[i]] += lightR[i];
+                    radianceG[pixel[i]] += lightG[i];
+                    radianceB[pixel[i]] += lightB[i];
+                    continue;
+                }
+                if (alive != i) {
+                    originX[alive] = originX[i]; originY[alive] = originY[i]; originZ[alive] = originZ[i];
+                    dirX[alive] = dirX[i]; dirY[alive] = dirY[i]; dirZ[alive] = dirZ[i];
+                    throughputR[alive] = throughputR[i]; throughputG[alive] = throughputG[i]; throughputB[alive] = throughputB[i];
+                    lightR[alive] = lightR[i]; lightG[alive] = lightG[i]; lightB[alive] = lightB[i];
+                    pixel[alive] = pixel[i];
+                    sample[alive] = sample[i];
+                    inside[alive] = inside[i];
+                }
+                alive++;
+            }
+            numPaths = alive;
+        }
+
+    public:
+        // Paths of a width*height block of pixels from (x0, y0), traced to the end
+        void render(const Camera& cam, const uint x0, const uint y0, const uint width, const uint height, const uint samples,
+                const Sampler& pixelSampler, const TLAS& tlas, const Array<BVH>& bvhs) {
+            sampler = &pixelSampler;
+            generate(cam, x0, y0, width, height, samples);
+            const uint maxBounce = Ray().getMaxBounce();
+            for (uint bounce = 0; bounce < maxBounce && numPaths > 0; bounce++) {
+                extend(tlas, bvhs, bounce == 0);
+                shade(bounce);
+                compact(bounce + 1 == maxBounce);
+            }
+        }
+
+        // Averaged over the samples of the pixel, (x, y) in the last rendered block
+        Pixel getPixel(const uint x, const uint y, const uint width) const {
+            const uint p = y*width + x;
+            return Pixel(Vector<float>(radianceR[p], radianceG[p], radianceB[p]) / samplesPerPixel);
+        }
+
+        // Rays traced since creation, all bounces
+        size_t getNumExtended() const {
+            return numExtended;
+        }
+};
@@ -8,7 +8,7 @@
 #include "Matrix.hpp"
 #include "Line.hpp"
 
-#include <cuda_runtime.h>
+#include "utils/cuda_compat.hpp"
 
 #include <omp.h>
 #include <string>
@@ -99,12 +99,9 @@ void animObj() {
 	cam.free();
 }
 
-void test_random() {
-	srand(time(NULL));
-	
-	RandomInterface random_test;
-	uint state = 894965656;
-
+// Khi² test of uniformity on [0, 1) over k classes, draw(i) being the i-th observation
+template <typename F>
+void khi2_check(F draw) {
 	float threshold = 124.34f;
 	uint n = 10000;
 	uint k = 100;
@@ -118,32 +115,308 @@ void test_random() {
 	}
 
 	for (uint i = 0; i<n; i++) {
-		observations[i] = random_test.randomValue(state);
-		//observations[i] = (1.f*rand()) / (1.f*RAND_MAX);
+		observations[i] = draw(i);
 		c[(int) (observations[i]*k)] += 1;
-		//state = random_test.randomValue(state)*100000000000000;
 	}
 
 	float khi_square = 0;
 	for (uint j=0; j<k; j++) {
-		//std::cout << c[j] << std::endl;
 		khi_square += std::pow(c[j] - (1.f*n)/(1.f*k), 2);
 	}
 	khi_square *= (1.f*k)/(1.f*n);
 	if (khi_square > threshold) {
 		throw Khi2Error(khi_square, threshold);
 	}
-	//std::cout << "khi² = " << khi_square << std::endl;
 }
 
-int main() {
+void test_random(const uint seed) {
+	RandomInterface random_test;
+	uint state = 894965656 + seed;
+	khi2_check([&](const uint i) { return random_test.randomValue(state + i); });
+}
+
+// One stream, then the first number of the streams of neighbour pixels, samples and bounces.
+// Nothing here depends on the run, so each check passes every time or never
+void test_random_streams() {
+	RandomGenerator generator = RandomGenerator(894965656);
+	khi2_check([&](const uint) { return generator.randomValue(); });
+	khi2_check([&](const uint i) { return RandomGenerator(i, 0, 0).randomValue(); });
+	khi2_check([&](const uint i) { return RandomGenerator(0, i, 0).randomValue(); });
+	khi2_check([&](const uint i) { return RandomGenerator(0, 0, i).randomValue(); });
+}
+
+// Samplers uniform over the samples of a pixel, the blue noise one over the pixels as well, and the Sobol pairs stratified :
+// 16 samples of a pixel, one in each cell of a 4x4 grid. Sobol pixels are independent, hashed like the RandomGenerator streams
+void test_sampler() {
+	Sampler sobol = Sampler(SOBOL_SAMPLER);
+	Sampler blueNoise = Sampler(BLUE_NOISE_SAMPLER, 100);
+	for (uint dimension = 0; dimension < 6; dimension++) {
+		khi2_check([&](const uint i) { return sobol.get(7, i, dimension); });
+		khi2_check([&](const uint i) { return blueNoise.get(7, i, dimension); });
+		khi2_check([&](const uint i) { return blueNoise.get(i, 3, dimension); });
+	}
+	blueNoise.free();
+	for (uint pixel = 0; pixel < 100; pixel++) {
+		for (uint dimension = 0; dimension < 6; dimension += 2) {
+			std::vector<bool> cells(16, false);
+			for (uint s = 0; s < 16; s++) {
+				const uint cell = (uint)(sobol.get(pixel, s, dimension)*4)*4 + (uint)(sobol.get(pixel, s, dimension + 1)*4);
+				if (cells[cell]) throw std::runtime_error("Sobol samples of pixel " + std::to_string(pixel) + " not stratified");
+				cells[cell] = true;
+			}
+		}
+	}
+}
+
+// Node arrays start on a cache line whatever their size, grown by push_back or bulk copied as BVHCache does,
+// otherwise half of the sibling pairs straddle two lines
+void test_node_alignment() {
+	for (uint n = 1; n < 2000; n++) {
+		Array<Node> grown;
+		for (uint i = 0; i < n % 70 + 1; i++) grown.push_back(Node());
+		Array<Node> copied = Array<Node>(grown.getCPUData(), grown.size());
+		for (const Node* nodes : {grown.getCPUData(), copied.getCPUData()}) {
+			if ((uintptr_t)nodes % Node::ARRAY_ALIGNMENT != 0) throw std::runtime_error("Node array not aligned on a cache line");
+		}
+		grown.free();
+		copied.free();
+	}
+}
+
+// Numbers drawn per second by N threads, with rand() behind its libc lock against one RandomGenerator stream per thread
+void benchmark_random() {
+	const uint draws = 1 << 22;
+	auto run = [&](const char* name, const uint nbThreads, auto draw) {
+		std::vector<std::thread> threads;
+		std::vector<double> sums(nbThreads * 8, 0.); // One cache line apart
+		auto start = std::chrono::steady_clock::now();
+		for (uint t=0; t<nbThreads; t++) {
+			threads.emplace_back([&, t]() {
+				double sum = 0.;
+				for (uint i=0; i<draws; i++) sum += draw(t, i);
+				sums[t * 8] = sum;
+			});
+		}
+		for (std::thread& thread : threads) thread.join();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		double mean = 0.;
+		for (uint t=0; t<nbThreads; t++) mean += sums[t * 8] / draws / nbThreads;
+		std::cout << name << " " << nbThreads << " threads:\t" << nbThreads * draws / elapsed.count() / 1E6 << " M/s (mean " << mean << ")\n";
+	};
+	const uint maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	for (uint nbThreads=1; ; nbThreads=std::min(2*nbThreads, maxThreads)) {
+		run("rand()", nbThreads, [](const uint, const uint) { return rand() / (RAND_MAX + 1.); });
+		run("Counter", nbThreads, [](const uint t, const uint i) { return RandomGenerator::Uniform(t, i); });
+		if (nbThreads == maxThreads) break;
+	}
+}
+
+// A batch of directions from SoA numbers, a loop the compiler vectorizes
+void cosine_hemisphere_soa(const Vector<float>& normal, const float* __restrict__ u1, const float* __restrict__ u2,
+		float* __restrict__ x, float* __restrict__ y, float* __restrict__ z, const uint n) {
+	for (uint i=0; i<n; i++) {
+		const Vector<float> dir = Sampling::cosineHemisphere(normal, u1[i], u2[i]).direction;
+		x[i] = dir.getX();
+		y[i] = dir.getY();
+		z[i] = dir.getZ();
+	}
+}
+
+// Directions drawn per second on one thread, with the average of a check of each : the Lambertian estimate cos / (pi pdf) of an albedo of 1
+void benchmark_sampling() {
+	const uint draws = 1 << 22;
+	const Vector<float> normal = Vector<float>(0.3f, -0.5f, 0.8f).normalize();
+	const Vector<float> incoming = Vector<float>(0.5f, 0.2f, -0.6f).normalize();
+	auto run = [&](const char* name, auto draw) {
+		double sum = 0.;
+		auto start = std::chrono::steady_clock::now();
+		for (uint i=0; i<draws; i++) {
+			RandomGenerator random = RandomGenerator(i, 0, 0);
+			sum += draw(random);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << name << ":\t" << draws / elapsed.count() / 1E6 << " M/s (estimate " << sum / draws << ")\n";
+	};
+	// What Material::getDiffusionDirection did, Box-Muller in double with a rejection loop
+	RandomInterface random_double;
+	run("randomDirection", [&](RandomGenerator& random) {
+		const Vector<float> dir = random_double.randomDirection(random.getSeed());
+		return (double)std::fabs(dir*normal) * 2;
+	});
+	run("Uniform sphere", [&](RandomGenerator& random) {
+		const float u1 = random.randomValue();
+		const Vector<float> dir = Sampling::uniformSphere(u1, random.randomValue());
+		return std::fabs(dir*normal) / (Sampling::Pi * 2 * Sampling::uniformSpherePdf());
+	});
+	run("Uniform hemisphere", [&](RandomGenerator& random) {
+		const float u1 = random.randomValue();
+		const Sampling::DirectionSample sample = Sampling::uniformHemisphere(normal, u1, random.randomValue());
+		return (sample.direction*normal) / (Sampling::Pi * sample.pdf);
+	});
+	run("Cosine hemisphere", [&](RandomGenerator& random) {
+		const float u1 = random.randomValue();
+		const Sampling::DirectionSample sample = Sampling::cosineHemisphere(normal, u1, random.randomValue());
+		return (sample.direction*normal) / (Sampling::Pi * sample.pdf);
+	});
+	// Density evaluated back for the drawn direction over the one drawn with it, 1 expected.
+	// Directions under the surface count 1 : the ones grazing the incoming ray lose the half vector to rounding
+	run("GGX alpha 0.3", [&](RandomGenerator& random) {
+		const float u1 = random.randomValue();
+		const Sampling::DirectionSample sample = Sampling::ggxReflection(normal, incoming, 0.3f, u1, random.randomValue());
+		return sample.direction*normal > 0 ? Sampling::ggxReflectionPdf(normal, incoming, sample.direction, 0.3f) / sample.pdf : 1.;
+	});
+
+	// The warp alone over SoA arrays, vectorized
+	std::vector<float> u1(draws), u2(draws), x(draws), y(draws), z(draws);
+	for (uint i=0; i<draws; i++) {
+		u1[i] = RandomGenerator::Uniform(i, 0);
+		u2[i] = RandomGenerator::Uniform(i, 1);
+	}
+	auto start = std::chrono::steady_clock::now();
+	cosine_hemisphere_soa(normal, u1.data(), u2.data(), x.data(), y.data(), z.data(), draws);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	double sum = 0.;
+	for (uint i=0; i<draws; i++) sum += x[i]*normal.getX() + y[i]*normal.getY() + z[i]*normal.getZ();
+	std::cout << "Cosine hemisphere, SoA warp only:\t" << draws / elapsed.count() / 1E6 << " M/s (mean cosine " << sum / draws << ", 2/3 expected)\n";
+}
+
+// Root mean square error against a reference render, for each sampler and a growing number of samples per pixel.
+// Then the same error once box blurred over 3x3 pixels, what is left of it at a distance : blue noise shows there
+void benchmark_sampler() {
+	const uint W = 160, H = 90;
+	const uint referenceSamples = 4096;
+	for (const std::string model : {"cube.obj", "knight.obj"}) {
+		Camera cam = Camera(Vector<float>(-3.,0.,1.5), Vector<float>(1,0,-0.2), W, H);
+		cam.move(-Vector<float>(5.0,0.,-1.5));
+		Environment env = Environment(&cam);
+		Material light = Materials::LIGHT;
+		env.addSquare(Vector(20.,20.,0.),Vector(-20.,20.,0.),Vector(-20.,-20.,0.),Vector(20.,-20.,0.), Colors::WHITE);
+		light.setColor(Colors::GREEN);
+		env.addSquare(Vector(0.,-2.,0.)*2,Vector(0.,-2.,2.)*2,Vector(2.,-2.,2.)*2,Vector(2.,-2.,0.)*2, light);
+		light.setColor(Colors::RED);
+		env.addSquare(Vector(0.,2.,0.)*2,Vector(2.,2.,0.)*2,Vector(2.,2.,2.)*2,Vector(0.,2.,2.)*2, light);
+		if (model == "cube.obj")
+			env.addObj(model, Vector<float>(0,0,0.5), 0.5, Material(Colors::WHITE, MaterialType::DEFAULT));
+		else
+			env.addObj(model, Vector<float>(0,0,0), 0.5, Material(Colors::WHITE, MaterialType::DEFAULT));
+		env.addObj("sphere.obj", Vector<float>(0,2,2), 0.5, Material(Colors::WHITE, MaterialType::MIRROR));
+		env.setMode(Mode::BVH_RAYTRACING);
+
+		auto image = [&]() {
+			std::vector<Vector<float>> pixels(W*H);
+			for (uint i=0; i<W*H; i++) pixels[i] = cam.getPixel(i).toVector();
+			return pixels;
+		};
+		// Independent of every sampler measured
+		env.setSampler(RANDOM_SAMPLER, 1);
+		env.setSamples(referenceSamples);
+		env.render();
+		const std::vector<Vector<float>> reference = image();
+
+		std::map<uint, std::map<SamplerType, std::pair<float, float>>> errors;
+		for (const SamplerType type : {RANDOM_SAMPLER, SOBOL_SAMPLER, BLUE_NOISE_SAMPLER}) {
+			env.setSampler(type);
+			for (uint samples=1; samples<=64; samples*=2) {
+				env.setSamples(samples);
+				env.render();
+				const std::vector<Vector<float>> pixels = image();
+				double squares = 0., blurredSquares = 0.;
+				for (uint y=0; y<H; y++) {
+					for (uint x=0; x<W; x++) {
+						const Vector<float> d = pixels[y*W + x] - reference[y*W + x];
+						squares += d*d;
+						Vector<float> blurred;
+						for (uint v=Utils::max(y, 1u)-1; v<=Utils::min(y+1, H-1); v++)
+							for (uint u=Utils::max(x, 1u)-1; u<=Utils::min(x+1, W-1); u++)
+								blurred += (pixels[v*W + u] - reference[v*W + u]) / 9.f;
+						blurredSquares += blurred*blurred;
+					}
+				}
+				errors[samples][type] = {std::sqrt(squares / (3*W*H)), std::sqrt(blurredSquares / (3*W*H))};
+			}
+		}
+		std::cout << "\n" << model << ", " << W << "x" << H << ", reference of " << referenceSamples << " random samples per pixel\n";
+		std::cout << "samples\trandom\t\tsobol\t\tblue noise\t(blurred : random\tsobol\t\tblue noise)\n";
+		for (auto& [samples, byType] : errors) {
+			std::cout << samples;
+			for (const SamplerType type : {RANDOM_SAMPLER, SOBOL_SAMPLER, BLUE_NOISE_SAMPLER}) std::cout << "\t" << byType[type].first;
+			for (const SamplerType type : {RANDOM_SAMPLER, SOBOL_SAMPLER, BLUE_NOISE_SAMPLER}) std::cout << "\t" << byType[type].second;
+			std::cout << "\n";
+		}
+	}
+}
+
+// Ground, two walls, the knight and a mirror sphere
+void knight_scene(Environment& env) {
+	env.addSquare(Vector(20.,20.,0.),Vector(-20.,20.,0.),Vector(-20.,-20.,0.),Vector(20.,-20.,0.), Colors::WHITE);
+	env.addSquare(Vector(0.,-2.,0.)*2,Vector(0.,-2.,2.)*2,Vector(2.,-2.,2.)*2,Vector(2.,-2.,0.)*2, Colors::RED);
+	env.addSquare(Vector(0.,2.,0.)*2,Vector(2.,2.,0.)*2,Vector(2.,2.,2.)*2,Vector(0.,2.,2.)*2, Colors::GREEN);
+	env.addObj("knight.obj", Vector<float>(0,0,0), 0.5, Colors::WHITE);
+	env.addObj("sphere.obj", Vector<float>(0,2,2), 0.5, Material(Colors::WHITE, MaterialType::MIRROR));
+}
+
+// Primary rays through every CPU traversal path on the knight scene, see Environment::benchmarkHost
+void benchmark_host() {
+	Camera cam = Camera(Vector<float>(-3.,0.,1.5), Vector<float>(1,0,-0.2), 1280, 720);
+	cam.move(-Vector<float>(5.0,0.,-1.5));
+	Environment env = Environment(&cam);
+	knight_scene(env);
+	env.benchmarkHost(1);
+}
+
+// Environment::autotune_bvhs on the knight scene, each mesh against the parameters of the scene. Then the CPU render timed before
+// and after, "before" using the .tune files of an earlier run if any
+void benchmark_autotune() {
+	Camera cam = Camera(Vector<float>(-3.,0.,1.5), Vector<float>(1,0,-0.2), 1280, 720);
+	cam.move(-Vector<float>(5.0,0.,-1.5));
+	Environment env = Environment(&cam);
+	knight_scene(env);
+	env.setMode(Mode::BVH_RAYTRACING);
+	env.setSamples(1);
+
+	auto timedRender = [&]() {
+		auto start = std::chrono::steady_clock::now();
+		env.render();
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	};
+	const float before = timedRender();
+	env.autotune_bvhs();
+	const float after = timedRender();
+	std::cout << "Render before tuning:\t" << before << "s\nRender after tuning:\t" << after << "s, x" << before / after << "\n";
+}
+
+int main(int argc, char** argv) {
 	static_assert(std::is_base_of<CudaReady, Pixel>::value == false);
 	static_assert(std::is_base_of<CudaReady, Array<double>>::value == true);
 	static_assert(std::is_base_of<CudaReady, BVH>::value == true);
 
 	for (uint i=0; i<10; i++)
-		test_random();
+		test_random(i);
+	test_random_streams();
+	test_sampler();
 	std::cout << "Tests on randomness passed" << std::endl;
+	test_node_alignment();
+	std::cout << "Tests on node alignment passed" << std::endl;
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-random") {
+		benchmark_random();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-sampling") {
+		benchmark_sampling();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-sampler") {
+		benchmark_sampler();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-host") {
+		benchmark_host();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--autotune") {
+		benchmark_autotune();
+		return EXIT_SUCCESS;
+	}
 
 	/*
 	uint W = 1280;
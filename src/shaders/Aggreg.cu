@@ -8,15 +8,21 @@ __device__ void AggregShader::shader(const int idx, int state) {
     params.cam.updatePixel(idx, Pixel(partialColor));
 }
 
+#ifndef HOST_ONLY
 __global__ void kernel(AggregShader shader, int state) {
     int idx = threadIdx.x + blockIdx.x * blockDim.x;
     if (idx < shader.getMaxIndex()) {
         shader.shader(idx, state);
     }
 }
+#endif
 
 void compute_shader(AggregShader shader, int state) {
-    kernel<<<shader.getNblocks(), shader.getBlocksize()>>>(shader, state);
-    cudaErrorCheck( cudaPeekAtLastError() ); // Checks for launch error
-    cudaErrorCheck( cudaDeviceSynchronize() ); // Checks for execution error
+    #ifdef HOST_ONLY
+        hostDispatch(shader.getMaxIndex(), shader.getBlocksize(), [&](const uint idx) { shader.shader(idx, state); });
+    #else
+        kernel<<<shader.getNblocks(), shader.getBlocksize()>>>(shader, state);
+        cudaErrorCheck( cudaPeekAtLastError() ); // Checks for launch error
+        cudaErrorCheck( cudaDeviceSynchronize() ); // Checks for execution error
+    #endif
 }
\ No newline at end of file
@@ -17,15 +17,21 @@ __device__ void ConvolutionShader::shader(const int idx) {
     params.cam.setPixel(idx, Pixel(center));
 }
 
+#ifndef HOST_ONLY
 __global__ void kernel(ConvolutionShader shader) {
     int idx = threadIdx.x + blockIdx.x * blockDim.x;
     if (idx < shader.getMaxIndex()) {
         shader.shader(idx);
     }
 }
+#endif
 
 void compute_shader(ConvolutionShader shader) {
-    kernel<<<shader.getNblocks(), shader.getBlocksize()>>>(shader);
-    cudaErrorCheck( cudaPeekAtLastError() ); // Checks for launch error
-    cudaErrorCheck( cudaDeviceSynchronize() ); // Checks for execution error
+    #ifdef HOST_ONLY
+        hostDispatch(shader.getMaxIndex(), shader.getBlocksize(), [&](const uint idx) { shader.shader(idx); });
+    #else
+        kernel<<<shader.getNblocks(), shader.getBlocksize()>>>(shader);
+        cudaErrorCheck( cudaPeekAtLastError() ); // Checks for launch error
+        cudaErrorCheck( cudaDeviceSynchronize() ); // Checks for execution error
+    #endif
 }
\ No newline at end of file
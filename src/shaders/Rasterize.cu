@@ -7,20 +7,53 @@ __device__ void RasterizeShader::shader(const int idx) {
     uint h = idx2/W;
 
     Ray ray = params.cam.generate_ray(w, h);
-    Vector<float> incomingLight = Tracing::rasterizeBVHDevice(ray, params.bvhs);
+    Vector<float> incomingLight = Tracing::rasterizeBVHDevice(ray, params.tlas, params.bvhs);
 
     params.cam.updatePixel(idx, Pixel(incomingLight));
 }
 
+#ifdef HOST_ONLY
+__host__ void RasterizeShader::shaderPacket(const uint block) {
+    const uint blockW = RayPacket16::WIDTH;
+    const uint blockH = RayPacket16::SIZE / RayPacket16::WIDTH;
+    const uint blocksX = (W + blockW - 1) / blockW;
+    const uint x0 = (block % blocksX) * blockW;
+    const uint y0 = (block / blocksX) * blockH;
+
+    Ray rays[RayPacket16::SIZE];
+    uint indices[RayPacket16::SIZE];
+    uint count = 0;
+    for (uint h = y0; h < Utils::min(y0 + blockH, H); h++) {
+        for (uint w = x0; w < Utils::min(x0 + blockW, W); w++) {
+            rays[count] = params.cam.generate_ray(w, h);
+            indices[count++] = params.cam.coordToIndex(w, h);
+        }
+    }
+    RayPacket16 packet = RayPacket16(rays, count);
+    packet.trace(params.tlas, params.bvhs);
+    for (uint i = 0; i < count; i++) {
+        const Hit hit = packet.getHit(i, params.bvhs);
+        const Vector<float> incomingLight = hit.getHasHit() ? hit.getMaterial().getColor().toVector() : Vector<float>();
+        params.cam.updatePixel(indices[i], Pixel(incomingLight));
+    }
+}
+#endif
+
+#ifndef HOST_ONLY
 __global__ void kernel(RasterizeShader shader) {
     int idx = threadIdx.x + blockIdx.x * blockDim.x;
     if (idx < shader.getMaxIndex()) {
         shader.shader(idx);
     }
 }
+#endif
 
 void compute_shader(RasterizeShader shader) {
-    kernel<<<shader.getNblocks(), shader.getBlocksize()>>>(shader);
-    cudaErrorCheck( cudaPeekAtLastError() ); // Checks for launch error
-    cudaErrorCheck( cudaDeviceSynchronize() ); // Checks for execution error
+    #ifdef HOST_ONLY
+        hostDispatch(shader.getNumPacketBlocks(), 16, [&](const uint block) { shader.shaderPacket(block); });
+    #else
+        kernel<<<shader.getNblocks(), shader.getBlocksize()>>>(shader);
+        cudaErrorCheck( cudaPeekAtLastError() ); // Checks for launch error
+        cudaErrorCheck( cudaDeviceSynchronize() ); // Checks for execution error
+    #endif
 }
\ No newline at end of file
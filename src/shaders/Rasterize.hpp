@@ -3,13 +3,19 @@
 #include "../Triangle.hpp"
 #include "../Hit.hpp"
 #include "../BVH.hpp"
+#include "../TLAS.hpp"
 #include "../utils/Array.hpp"
 #include "../Camera.hpp"
 
 #include "Shader.hpp"
 
+#ifdef HOST_ONLY
+    #include "../RayPacket.hpp"
+#endif
+
 struct RasterizeShaderParams {
     Array<BVH> bvhs;
+    TLAS tlas;
     Camera cam;
 };
 
@@ -21,6 +27,13 @@ class RasterizeShader : public Shader {
             params = _params;
         };
         __device__ void shader(const int idx);
+        #ifdef HOST_ONLY
+        // Pixels of one 4x4 block, whose primary rays are traced as a single packet
+        __host__ void shaderPacket(const uint block);
+        __host__ uint getNumPacketBlocks() const {
+            return ((W + RayPacket16::WIDTH - 1) / RayPacket16::WIDTH) * ((H + RayPacket16::SIZE/RayPacket16::WIDTH - 1) / (RayPacket16::SIZE/RayPacket16::WIDTH));
+        }
+        #endif
 };
 
 __global__ void kernel(RasterizeShader shader);
@@ -3,15 +3,19 @@
 #include "../Triangle.hpp"
 #include "../Hit.hpp"
 #include "../BVH.hpp"
+#include "../TLAS.hpp"
 #include "../utils/Array.hpp"
 #include "../Camera.hpp"
+#include "../utils/Sampler.hpp"
 
 #include "Shader.hpp"
 
 struct RayTraceShaderParams {
     Array<BVH> bvhs;
+    TLAS tlas;
     Camera cam;
     uint samplesByThread;
+    Sampler sampler; // Seeded with the frame
 };
 
 class RayTraceShader : public Shader, RandomInterface {
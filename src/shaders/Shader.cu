@@ -6,4 +6,11 @@ void cudaAssert(const cudaError err, const char *file, const int line) {
                 file, line, cudaGetErrorString(err) );
         exit(1);
     } 
-}
\ No newline at end of file
+}
+
+#ifdef HOST_ONLY
+ThreadPool& hostPool() {
+    static ThreadPool pool;
+    return pool;
+}
+#endif
\ No newline at end of file
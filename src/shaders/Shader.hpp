@@ -1,10 +1,15 @@
 #pragma once
 
 #include <cstdio>
-#include <cuda_runtime.h>
+#include "../utils/cuda_compat.hpp"
 
 #include "../utils/Random.hpp"
 
+#ifdef HOST_ONLY
+    #include <algorithm>
+    #include "../utils/ThreadPool.hpp"
+#endif
+
 #define cudaErrorCheck(call){cudaAssert(call,__FILE__,__LINE__);}
 
 void cudaAssert(const cudaError err, const char *file, const int line);
@@ -46,3 +51,19 @@ class Shader {
 
         //__device__ void shader(int idx, int state); // Function to override
 };
+
+#ifdef HOST_ONLY
+// Shared by every launch of the host build, started on the first one
+ThreadPool& hostPool();
+
+// Host side launch : body(idx) for every idx in [0, numIndices), the blocks of the CUDA grid being the tasks of the pool
+template<typename F>
+void hostDispatch(const uint numIndices, const uint blocksize, const F& body) {
+    const uint numBlocks = (numIndices + blocksize - 1) / blocksize;
+    hostPool().run(numBlocks, [&](const uint block, const uint) {
+        for (uint idx = block*blocksize; idx < std::min(numIndices, (block+1)*blocksize); idx++) {
+            body(idx);
+        }
+    });
+}
+#endif
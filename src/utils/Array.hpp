@@ -1,6 +1,7 @@
 #pragma once
 
 #include <type_traits>
+#include <algorithm>
 #include "cuda_ready.hpp"
 
 #define cudaErrorCheck(call){cudaAssert(call,__FILE__,__LINE__);}
@@ -12,6 +13,7 @@ class Array : public CudaReady {
         T* data_cpu;
         T* data_gpu = nullptr;
         uint data_size;
+        uint gpu_size = 0;
         uint spaceUsed = 0;
         
     public:
@@ -26,28 +28,47 @@ class Array : public CudaReady {
             push_back(item);
         };
 
+        // Bulk copy of count items, e.g. from a mapped file
+        __host__ Array(const T* items, const uint count) : data_size(count), spaceUsed(count) {
+            data_cpu = new T[data_size];
+            data = data_cpu;
+            std::copy(items, items + count, data_cpu);
+        };
+
         __host__ uint push_back(const T item) {
             if (spaceUsed == data_size) {
-                data_size++;
-                T* tri_tmp = new T[data_size];
-                for (uint i = 0; i < spaceUsed; i++) {
-                    tri_tmp[i] = data[i];
-                }
-                if (data != nullptr)
-                    delete[] data;
-                data = tri_tmp;
+                reserve(data_size == 0 ? 1 : 2*data_size); // Geometric growth keeps push_back amortized O(1)
             }
             data[spaceUsed++] = item;
-            data_cpu = data;
             return spaceUsed-1;
         }
 
+        // Storage for at least capacity items, items below it never move until then
+        __host__ void reserve(const uint capacity) {
+            if (capacity <= data_size) return;
+            data_size = capacity;
+            T* tri_tmp = new T[data_size];
+            for (uint i = 0; i < spaceUsed; i++) {
+                tri_tmp[i] = data[i];
+            }
+            if (data != nullptr)
+                delete[] data;
+            data = tri_tmp;
+            data_cpu = data;
+        }
+
+        // Items between the old and new size are the ones already in storage, e.g. written through another copy
+        __host__ void resize(const uint count) {
+            reserve(count);
+            spaceUsed = count;
+        }
+
         __host__ __device__ uint size() const {
             return spaceUsed;
         }
 
         template<typename I>
-        __host__ __device__ T operator[](const I i) const {
+        __host__ __device__ const T& operator[](const I i) const {
             //printf("%d, %u, %d\n", spaceUsed + i, spaceUsed, i);
             if constexpr (std::is_signed_v<I>) {
                 if (i < 0)
@@ -66,6 +87,10 @@ class Array : public CudaReady {
             return data[i];
         }
 
+        __host__ const T* getCPUData() const {
+            return data_cpu;
+        }
+
         template<typename I>
         __host__ __device__ T getValueFromCPU(const I i) const {
             if constexpr (std::is_signed_v<I>) {
@@ -76,23 +101,35 @@ class Array : public CudaReady {
         }
         
         __host__ void cuda() override {
+            if (data_gpu != nullptr && data == data_gpu) return; // Already on device
             if constexpr (std::is_base_of<CudaReady, T>::value) {
                 for (uint i=0; i<size(); i++) {
                     data[i].cuda();
                 }
             }
+            #ifndef HOST_ONLY
+            if (data_gpu != nullptr && gpu_size < data_size) {
+                // Grown on the host since the last upload
+                cudaErrorCheck(cudaFree(data_gpu));
+                data_gpu = nullptr;
+            }
             if (data_gpu == nullptr) {
                 //std::cout << "Allocating : " << data_size*sizeof(T) << " bytes" << std::endl;
                 cudaErrorCheck(cudaMalloc(&data_gpu, data_size*sizeof(T)));
-                cudaErrorCheck(cudaMemcpy(data_gpu, data_cpu, data_size*sizeof(T), cudaMemcpyHostToDevice));
+                gpu_size = data_size;
             }
+            // Host data may have changed since a previous cpu(), always refresh the device copy
+            cudaErrorCheck(cudaMemcpy(data_gpu, data_cpu, data_size*sizeof(T), cudaMemcpyHostToDevice));
             data = data_gpu;
+            #endif
         }
 
         __host__ void cpu() override {
-            if (data_gpu != nullptr) {
+            #ifndef HOST_ONLY
+            if (data_gpu != nullptr && data == data_gpu) {
                 cudaErrorCheck(cudaMemcpy(data_cpu, data_gpu, data_size*sizeof(T), cudaMemcpyDeviceToHost));
             }
+            #endif
             data = data_cpu;
             if constexpr (std::is_base_of<CudaReady, T>::value) {
                 for (uint i=0; i<size(); i++) {
@@ -102,9 +139,11 @@ class Array : public CudaReady {
         }
 
         __host__ void sync_to_cpu() override {
+            #ifndef HOST_ONLY
             if (data_cpu != nullptr && data_gpu != nullptr) {
                 cudaErrorCheck(cudaMemcpy(data_cpu, data_gpu, data_size*sizeof(T), cudaMemcpyDeviceToHost));
             }
+            #endif
             if constexpr (std::is_base_of<CudaReady, T>::value) {
                 for (uint i=0; i<size(); i++) {
                     data[i].sync_to_cpu();
@@ -112,6 +151,18 @@ class Array : public CudaReady {
             }
         }
 
+        // Releases the device copy only, the host data stays with whoever owns it
+        __host__ void freeDevice() {
+            #ifndef HOST_ONLY
+            if (data_gpu != nullptr) {
+                cudaErrorCheck(cudaFree(data_gpu));
+                data_gpu = nullptr;
+                gpu_size = 0;
+            }
+            #endif
+            data = data_cpu;
+        }
+
         __host__ void free() override {
             if constexpr (std::is_base_of<CudaReady, T>::value) {
                 for (uint i=0; i<size(); i++) {
@@ -123,9 +174,11 @@ class Array : public CudaReady {
                 data = nullptr;
                 data_cpu = nullptr;
             }
+            #ifndef HOST_ONLY
             if (data_gpu != nullptr) {
                 cudaErrorCheck(cudaFree(data_gpu));
                 data_gpu = nullptr;
             }
+            #endif
         }
 };
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+namespace Utils {
+    // 64 bits FNV-1a, chain calls through seed to hash several buffers
+    inline uint64_t hash(const void* bytes, const size_t size, uint64_t seed = 0xcbf29ce484222325ull) {
+        const unsigned char* data = static_cast<const unsigned char*>(bytes);
+        for (size_t i = 0; i < size; i++) {
+            seed ^= data[i];
+            seed *= 0x100000001b3ull;
+        }
+        return seed;
+    }
+
+    template<typename T>
+    inline uint64_t hash(const T& value, const uint64_t seed) {
+        return hash(&value, sizeof(T), seed);
+    }
+
+    // 16 hexadecimal digits, e.g. to name a file after a hash
+    inline std::string hex(const uint64_t value) {
+        char digits[17];
+        snprintf(digits, sizeof(digits), "%016llx", (unsigned long long)value);
+        return digits;
+    }
+}
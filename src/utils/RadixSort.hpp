@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace Utils {
+    /*
+    Stable LSD radix sort of 64 bits keys on bits [firstBit, lastBit), 8 bits per pass.
+    Each thread counts its own chunk, then scatters it at offsets laid out thread after thread, which keeps the sort stable.
+    */
+    inline void radixSort(std::vector<uint64_t>& keys, const uint firstBit = 0, const uint lastBit = 64) {
+        constexpr uint RADIX_BITS = 8;
+        constexpr uint RADIX = 1u << RADIX_BITS;
+        const size_t n = keys.size();
+        std::vector<uint64_t> buffer(n);
+#ifdef _OPENMP
+        const int maxThreads = omp_get_max_threads();
+#else
+        const int maxThreads = 1;
+#endif
+        std::vector<size_t> offsets(maxThreads * RADIX);
+
+        for (uint shift = firstBit; shift < lastBit; shift += RADIX_BITS) {
+            #pragma omp parallel num_threads(maxThreads)
+            {
+#ifdef _OPENMP
+                const int thread = omp_get_thread_num();
+                const int numThreads = omp_get_num_threads();
+#else
+                const int thread = 0;
+                const int numThreads = 1;
+#endif
+                const size_t begin = n * thread / numThreads;
+                const size_t end = n * (thread + 1) / numThreads;
+                size_t* count = &offsets[thread * RADIX];
+                for (uint d = 0; d < RADIX; d++) count[d] = 0;
+                for (size_t i = begin; i < end; i++) {
+                    count[(keys[i] >> shift) & (RADIX - 1)]++;
+                }
+
+                #pragma omp barrier
+                #pragma omp single
+                {
+                    size_t sum = 0;
+                    for (uint d = 0; d < RADIX; d++) {
+                        for (int t = 0; t < numThreads; t++) {
+                            const size_t c = offsets[t * RADIX + d];
+                            offsets[t * RADIX + d] = sum;
+                            sum += c;
+                        }
+                    }
+                }
+
+                for (size_t i = begin; i < end; i++) {
+                    buffer[count[(keys[i] >> shift) & (RADIX - 1)]++] = keys[i];
+                }
+            }
+            keys.swap(buffer);
+        }
+    }
+}
@@ -1,29 +1,74 @@
 #pragma once
 
 #include "../Vector.hpp"
+#include "Sampling.hpp"
 
-#include <cuda_runtime.h>
-#include <curand.h>
-#include <curand_kernel.h>
+#include "cuda_compat.hpp"
+#ifndef HOST_ONLY
+    #include <curand.h>
+    #include <curand_kernel.h>
+#endif
 
 #include <exception>
 
 #define PI 3.141592653589f
 
+/*
+Counter-based generator : the n-th number of a stream is a pure function of its key and n, nothing is shared between threads
+nor kept from one draw to the next but the counter. Keyed by pixel, sample and bounce, a path draws the same numbers
+whatever the thread, the tile order or the device tracing it, so renders are reproducible.
+Hash from the PCG family, see Jarzynski and Olano, Hash Functions for GPU Rendering (2020).
+*/
 class RandomGenerator {
+    public:
+        static constexpr uint BOUNCE_DIMENSIONS = 4; // Numbers Material::trace draws per bounce
+
     private:
-        unsigned long inner_state = 0;
+        uint key = 0;
+        uint counter = 0;
+        float sampled[BOUNCE_DIMENSIONS]; // Given by a Sampler, drawn first
+        uint numSampled = 0;
+
     public:
         __host__ __device__ RandomGenerator() {};
-        __host__ __device__ RandomGenerator(const unsigned long seed) : inner_state(seed) {};
+        __host__ __device__ RandomGenerator(const unsigned long seed) : key(Hash((uint)seed ^ (uint)(seed >> 32))) {};
+        // Stream of one path vertex, seed changes from one frame to the next. Hashed alone so that seed + 1 is not pixel + 1
+        __host__ __device__ RandomGenerator(const uint pixel, const uint sample, const uint bounce, const uint seed = 0)
+            : key(Hash(Hash(Hash(Hash(seed) ^ pixel) + sample) + bounce)) {};
+        // The same stream, its first numbers replaced by the ones of a Sampler
+        __host__ __device__ RandomGenerator(const uint pixel, const uint sample, const uint bounce, const uint seed, const float* values, const uint count)
+            : RandomGenerator(pixel, sample, bounce, seed) {
+            numSampled = count < BOUNCE_DIMENSIONS ? count : BOUNCE_DIMENSIONS;
+            for (uint i = 0; i < numSampled; i++) {
+                sampled[i] = values[i];
+            }
+        };
         __host__ __device__ ~RandomGenerator() {};
 
+        __host__ __device__ static uint Hash(const uint value) {
+            const uint state = value*747796405u + 2891336453u;
+            const uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+            return (word >> 22u) ^ word;
+        }
+
+        // In [0, 1), the 24 high bits fill the float mantissa
+        __host__ __device__ static float ToUnit(const uint bits) {
+            return (bits >> 8) * (1.f / 16777216.f);
+        }
+
+        // Number n of the stream key
+        __host__ __device__ static float Uniform(const uint key, const uint n) {
+            return ToUnit(Hash(key ^ Hash(n)));
+        }
+
         __host__ __device__ unsigned long getSeed() const {
-            return inner_state;
+            return key;
         }
 
         __host__ __device__ void updateSeed(const unsigned long seed) {
-            inner_state += seed;
+            key = Hash(key + (uint)seed);
+            counter = 0;
+            numSampled = 0;
         }
 
         __host__ __device__ float randomValue(uint& state) {
@@ -82,48 +127,33 @@ class RandomGenerator {
 
 
         __host__ __device__ float randomValue() {
-            const unsigned long a = 1664525; // multiplier
-            const unsigned long c = 1013904223; // increment
-            const unsigned long m = 4294967296; // 2^32
-            inner_state = (a * inner_state + c) % m;
-            return static_cast<float>(inner_state) / (m - 1);
+            const uint n = counter++;
+            return n < numSampled ? sampled[n] : Uniform(key, n);
         }
 
         __host__ __device__ float randomValueNormalDistribution() { 
             float theta = 2 * PI * randomValue();
-            const float rho = std::sqrt(-2*std::log(randomValue()));
+            const float rho = std::sqrt(-2*std::log(1.f - randomValue())); // In (0, 1]
             return rho*std::cos(theta);
         }
 
+        // Uniform on the unit sphere
         __host__ __device__ Vector<float> randomDirection() {
-            float x;  float y;  float z;
-            do {
-                x = randomValueNormalDistribution();
-                y = randomValueNormalDistribution();
-                z = randomValueNormalDistribution();
-            } while ( std::abs(x)<1E-5 && std::abs(y)<1E-5 && std::abs(z)<1E-5);            
-            return Vector<float>(x,y,z).normalize();
+            const float u1 = randomValue();
+            return Sampling::uniformSphere(u1, randomValue());
         }
 };
 
+// One number per state, the same on the host and the device. Paths draw from a RandomGenerator stream instead
 class RandomInterface {
     public:
         __host__ __device__ double randomValue(uint state) {
-            #ifdef  __CUDA_ARCH__
-                state *= (clock64() % 10) ^ 156;
-            #else
-                state = rand();
-            #endif
-
-            state = state*747796405 + 2891336453;
-            uint result = ((state >> ((state >> 28) + 4)) ^ state) * 277803737;
-            result = (result >> 22) ^ result;
-            return result / 4294967295.0;
+            return RandomGenerator::ToUnit(RandomGenerator::Hash(state));
         }
 
         __host__ __device__ double randomValueNormalDistribution(uint state) { 
             double theta = 2 * PI * randomValue(state);
-            double rho = std::sqrt(-2*std::log(randomValue(state*state)));
+            double rho = std::sqrt(-2*std::log(1 - randomValue(state*state))); // In (0, 1]
             return rho*std::cos(theta);
         }
 
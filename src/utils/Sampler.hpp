@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "Array.hpp"
+#include "Random.hpp"
+#include "MinMax.hpp"
+#include "cuda_compat.hpp"
+
+/*
+Numbers of the paths by pixel, sample and dimension : dimensions 0 and 1 place the camera ray in its pixel,
+then each bounce takes RandomGenerator::BOUNCE_DIMENSIONS more, in the order Material::trace draws them.
+    RANDOM_SAMPLER      the RandomGenerator streams alone, independent numbers
+    SOBOL_SAMPLER       Owen scrambled Sobol : each pair of dimensions is a (0, 2) sequence over the samples of a pixel,
+                        shuffled and scrambled by a hash of the pixel (Burley, Practical Hash-based Owen Scrambling, 2020)
+    BLUE_NOISE_SAMPLER  one scrambled Sobol sequence for the whole image, toroidally shifted in each pixel by a void and cluster
+                        mask tiled over the image, itself shifted per dimension : the samples of a pixel are as well spread
+                        as with SOBOL_SAMPLER and neighbour pixels get distant shifts, what error is left is high frequency
+                        noise (Georgiev and Fajardo, Blue-noise Dithered Sampling, 2016)
+The type is checked in a switch rather than through virtual calls, so that the device can use a sampler made on the host.
+*/
+enum SamplerType {
+    RANDOM_SAMPLER,
+    SOBOL_SAMPLER,
+    BLUE_NOISE_SAMPLER
+};
+
+class Sampler : public CudaReady {
+    public:
+        static constexpr uint PIXEL_DIMENSIONS = 2;
+        static constexpr uint MASK_SIZE = 64; // Side of the blue noise mask, in pixels
+
+    private:
+        SamplerType type = SOBOL_SAMPLER;
+        uint width = 0; // Of the image, pixels are indices
+        uint seed = 0;
+        Array<float> mask; // MASK_SIZE*MASK_SIZE ranks in (0, 1), BLUE_NOISE_SAMPLER only
+
+    public:
+        __host__ __device__ Sampler() {};
+        __host__ Sampler(const SamplerType type, const uint width = 0, const uint seed = 0) : type(type), width(width), seed(seed) {
+            if (type == BLUE_NOISE_SAMPLER) {
+                if (width == 0) throw std::invalid_argument("The blue noise sampler needs the width of the image");
+                const std::vector<float> ranks = VoidAndCluster(MASK_SIZE);
+                mask = Array<float>(ranks.data(), ranks.size());
+            }
+        };
+
+        __host__ void cuda() override {
+            mask.cuda();
+        }
+
+        __host__ void cpu() override {
+            mask.cpu();
+        }
+
+        __host__ void sync_to_cpu() override {
+            mask.sync_to_cpu();
+        }
+
+        __host__ void free() override {
+            mask.free();
+        }
+
+        __host__ __device__ SamplerType getType() const {
+            return type;
+        }
+
+        // Changes every number, e.g. from one frame to the next
+        __host__ void setSeed(const uint s) {
+            seed = s;
+        }
+
+        __host__ __device__ static uint ReverseBits(uint x) {
+            #ifdef __CUDA_ARCH__
+                return __brev(x);
+            #else
+                x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+                x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+                x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+                x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+                return (x >> 16) | (x << 16);
+            #endif
+        }
+
+        // The first two Sobol dimensions : van der Corput, then the one of polynomial x + 1. Together a (0, 2) sequence
+        __host__ __device__ static uint Sobol(uint index, const uint dimension) {
+            if (dimension == 0) return ReverseBits(index);
+            uint result = 0;
+            for (uint direction = 1u << 31; index != 0; index >>= 1, direction ^= direction >> 1) {
+                if (index & 1) result ^= direction;
+            }
+            return result;
+        }
+
+        // Nested uniform scrambling : each bit flipped by a hash of the bits above it (Laine and Karras hash, constants of Burley)
+        __host__ __device__ static uint OwenScramble(uint x, const uint key) {
+            x = ReverseBits(x);
+            x += key;
+            x ^= x * 0x6c50b47cu;
+            x ^= x * 0xb82f1e52u;
+            x ^= x * 0xc7afe638u;
+            x ^= x * 0x8d22f6e6u;
+            return ReverseBits(x);
+        }
+
+        // Ranks of a void and cluster pattern (Ulichney, 1993) on a toroidal size*size grid, scaled into (0, 1)
+        __host__ static std::vector<float> VoidAndCluster(const uint size, const uint key = 0) {
+            const uint n = size*size;
+            const float sigma = 1.5f;
+            std::vector<float> kernel(n); // Gaussian of the toroidal offset
+            for (uint y = 0; y < size; y++) {
+                for (uint x = 0; x < size; x++) {
+                    const float dx = Utils::min(x, size - x), dy = Utils::min(y, size - y);
+                    kernel[y*size + x] = std::exp(-(dx*dx + dy*dy) / (2.f*sigma*sigma));
+                }
+            }
+            std::vector<float> energy(n, 0.f);
+            std::vector<char> pattern(n, false);
+            auto splat = [&](const uint p, const float sign) {
+                const uint px = p % size, py = p / size;
+                for (uint y = 0; y < size; y++) {
+                    const float* row = &kernel[((y + size - py) % size)*size];
+                    for (uint x = 0; x < size; x++) {
+                        energy[y*size + x] += sign * row[(x + size - px) % size];
+                    }
+                }
+                pattern[p] = sign > 0;
+            };
+            // Tightest cluster : the set point of highest energy, largest void : the empty one of lowest
+            auto tightest = [&]() {
+                uint best = n;
+                for (uint i = 0; i < n; i++) {
+                    if (pattern[i] && (best == n || energy[i] > energy[best])) best = i;
+                }
+                return best;
+            };
+            auto largest = [&]() {
+                uint best = n;
+                for (uint i = 0; i < n; i++) {
+                    if (!pattern[i] && (best == n || energy[i] < energy[best])) best = i;
+                }
+                return best;
+            };
+
+            // A tenth of the points at random, moved from clusters to voids until the pattern is stable
+            const uint ones = n / 10;
+            for (uint i = 0, placed = 0; placed < ones; i++) {
+                const uint p = RandomGenerator::Hash(key + i) % n;
+                if (pattern[p]) continue;
+                splat(p, 1.f);
+                placed++;
+            }
+            for (uint i = 0; i < n; i++) {
+                const uint cluster = tightest();
+                splat(cluster, -1.f);
+                const uint hole = largest();
+                splat(hole, 1.f);
+                if (hole == cluster) break;
+            }
+
+            std::vector<float> rank(n);
+            const std::vector<char> initialPattern = pattern;
+            const std::vector<float> initialEnergy = energy;
+            for (uint r = ones; r-- > 0;) {
+                const uint cluster = tightest();
+                splat(cluster, -1.f);
+                rank[cluster] = r;
+            }
+            pattern = initialPattern;
+            energy = initialEnergy;
+            // Ulichney takes the tightest clusters of empty points past half the grid, the largest voids do as well here
+            for (uint r = ones; r < n; r++) {
+                const uint hole = largest();
+                splat(hole, 1.f);
+                rank[hole] = r;
+            }
+            for (uint i = 0; i < n; i++) {
+                rank[i] = (rank[i] + 0.5f) / n;
+            }
+            return rank;
+        }
+
+        // Scrambled Sobol sequence of key, the sample index shuffled per pair of dimensions so that pairs do not correlate
+        __host__ __device__ static float ScrambledSobol(const uint key, const uint sample, const uint dimension) {
+            const uint index = OwenScramble(sample, RandomGenerator::Hash(key + dimension / 2));
+            return RandomGenerator::ToUnit(OwenScramble(Sobol(index, dimension % 2), RandomGenerator::Hash(key ^ RandomGenerator::Hash(dimension))));
+        }
+
+        // In [0, 1). The seed is hashed alone so that seed + 1 is neither pixel + 1 nor dimension + 1
+        __host__ __device__ float get(const uint pixel, const uint sample, const uint dimension) const {
+            const uint seedKey = RandomGenerator::Hash(seed);
+            switch (type) {
+                case SOBOL_SAMPLER:
+                    return ScrambledSobol(RandomGenerator::Hash(seedKey ^ pixel), sample, dimension);
+                case BLUE_NOISE_SAMPLER: {
+                    const uint shift = RandomGenerator::Hash(seedKey ^ dimension);
+                    const uint x = (pixel % width + shift) % MASK_SIZE;
+                    const uint y = (pixel / width + (shift >> 16)) % MASK_SIZE;
+                    const float value = ScrambledSobol(seedKey, sample, dimension) + mask[y*MASK_SIZE + x];
+                    return Utils::min(value - floorf(value), 0.99999994f);
+                }
+                default: {
+                    // Pixel dimensions from a stream of their own, past the ones of the bounces
+                    const uint bounce = dimension < PIXEL_DIMENSIONS ? ~0u : (dimension - PIXEL_DIMENSIONS) / RandomGenerator::BOUNCE_DIMENSIONS;
+                    const uint n = dimension < PIXEL_DIMENSIONS ? dimension : (dimension - PIXEL_DIMENSIONS) % RandomGenerator::BOUNCE_DIMENSIONS;
+                    return RandomGenerator::Uniform(RandomGenerator(pixel, sample, bounce, seed).getSeed(), n);
+                }
+            }
+        }
+
+        // Position of the camera ray in the pixel, from its center, in [-0.5, 0.5)
+        __host__ __device__ void pixelOffset(const uint pixel, const uint sample, float& dx, float& dy) const {
+            dx = get(pixel, sample, 0) - 0.5f;
+            dy = get(pixel, sample, 1) - 0.5f;
+        }
+
+        // Stream of one bounce of a path, see Material::trace
+        __host__ __device__ RandomGenerator bounce(const uint pixel, const uint sample, const uint bounce) const {
+            if (type == RANDOM_SAMPLER) return RandomGenerator(pixel, sample, bounce, seed);
+            float values[RandomGenerator::BOUNCE_DIMENSIONS];
+            const uint first = PIXEL_DIMENSIONS + bounce*RandomGenerator::BOUNCE_DIMENSIONS;
+            for (uint i = 0; i < RandomGenerator::BOUNCE_DIMENSIONS; i++) {
+                values[i] = get(pixel, sample, first + i);
+            }
+            return RandomGenerator(pixel, sample, bounce, seed, values, RandomGenerator::BOUNCE_DIMENSIONS);
+        }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cmath>
+
+#include "../Vector.hpp"
+#include "cuda_compat.hpp"
+#include "MinMax.hpp"
+
+/*
+Warps from uniform numbers in [0, 1) to points and directions. Float only, no rejection loop and no branch on the numbers,
+so that a loop drawing many samples vectorizes (sqrt needs -fno-math-errno, see the Makefile) and device threads do not diverge.
+Directions come with their density per steradian, an estimator divides its integrand by it.
+*/
+namespace Sampling {
+    constexpr float Pi = 3.141592653589f;
+
+    // Sine and cosine of 2 pi u for u in [0, 1), polynomial instead of the libm calls so that loops vectorize.
+    // Folded on [-pi/2, pi/2] without branch, error under 1E-6
+    __host__ __device__ inline void sinCos2Pi(const float u, float& sine, float& cosine) {
+        const float x = 2.f * Pi * (u - 0.5f); // Angle minus pi, both signs flip
+        const float folded = std::copysign(Utils::min(fabsf(x), Pi - fabsf(x)), x);
+        const float x2 = folded*folded;
+        const float s = folded * (1.f + x2 * (-1.f/6 + x2 * (1.f/120 + x2 * (-1.f/5040 + x2 * (1.f/362880 + x2 * (-1.f/39916800))))));
+        const float c = 1.f + x2 * (-1.f/2 + x2 * (1.f/24 + x2 * (-1.f/720 + x2 * (1.f/40320 + x2 * (-1.f/3628800 + x2 * (1.f/479001600))))));
+        sine = -s;
+        cosine = std::copysign(c, fabsf(x) - 0.5f * Pi);
+    }
+
+    struct DirectionSample {
+        Vector<float> direction;
+        float pdf;
+    };
+
+    // Tangent and bitangent of a unit normal, no branch on its sign (Duff et al., Building an Orthonormal Basis, Revisited, 2017)
+    __host__ __device__ inline void basis(const Vector<float>& normal, Vector<float>& tangent, Vector<float>& bitangent) {
+        const float sign = std::copysign(1.f, normal.getZ());
+        const float a = -1.f / (sign + normal.getZ());
+        const float b = normal.getX() * normal.getY() * a;
+        tangent = Vector<float>(1.f + sign * normal.getX() * normal.getX() * a, sign * b, -sign * normal.getX());
+        bitangent = Vector<float>(b, sign + normal.getY() * normal.getY() * a, -normal.getY());
+    }
+
+    // (x, y, z) in the frame where normal is z
+    __host__ __device__ inline Vector<float> toWorld(const Vector<float>& normal, const float x, const float y, const float z) {
+        Vector<float> tangent, bitangent;
+        basis(normal, tangent, bitangent);
+        return tangent*x + bitangent*y + normal*z;
+    }
+
+    // Uniform on the unit disk, polar map
+    __host__ __device__ inline void uniformDisk(const float u1, const float u2, float& x, float& y) {
+        const float r = std::sqrt(u1);
+        float sine, cosine;
+        sinCos2Pi(u2, sine, cosine);
+        x = r * cosine;
+        y = r * sine;
+    }
+
+    __host__ __device__ inline float uniformDiskPdf() {
+        return 1.f / Pi;
+    }
+
+    __host__ __device__ inline Vector<float> uniformSphere(const float u1, const float u2) {
+        const float z = 1.f - 2.f * u1;
+        const float r = std::sqrt(Utils::max(0.f, 1.f - z*z));
+        float sine, cosine;
+        sinCos2Pi(u2, sine, cosine);
+        return Vector<float>(r * cosine, r * sine, z);
+    }
+
+    __host__ __device__ inline float uniformSpherePdf() {
+        return 0.25f / Pi;
+    }
+
+    __host__ __device__ inline float uniformHemispherePdf() {
+        return 0.5f / Pi;
+    }
+
+    // Uniform over the side of normal
+    __host__ __device__ inline DirectionSample uniformHemisphere(const Vector<float>& normal, const float u1, const float u2) {
+        const float z = 1.f - u1;
+        const float r = std::sqrt(Utils::max(0.f, 1.f - z*z));
+        float sine, cosine;
+        sinCos2Pi(u2, sine, cosine);
+        return {toWorld(normal, r * cosine, r * sine, z), uniformHemispherePdf()};
+    }
+
+    __host__ __device__ inline float cosineHemispherePdf(const float cosTheta) {
+        return Utils::max(0.f, cosTheta) / Pi;
+    }
+
+    // Density proportional to the cosine with normal (Malley : the uniform disk lifted on the hemisphere), a Lambertian bounce weighs its albedo
+    __host__ __device__ inline DirectionSample cosineHemisphere(const Vector<float>& normal, const float u1, const float u2) {
+        float x, y;
+        uniformDisk(u1, u2, x, y);
+        const float z = std::sqrt(Utils::max(0.f, 1.f - u1));
+        return {toWorld(normal, x, y, z), cosineHemispherePdf(z)};
+    }
+
+    // GGX (Trowbridge-Reitz) distribution of roughness alpha, density of a half vector of cosine cosTheta with the normal
+    __host__ __device__ inline float ggxD(const float cosTheta, const float alpha) {
+        const float a2 = alpha*alpha;
+        const float d = cosTheta*cosTheta * (a2 - 1.f) + 1.f;
+        return a2 / (Pi * d*d);
+    }
+
+    // incoming going towards the surface, reflected around a half vector drawn in proportion to D(h) cos(h, normal).
+    // The direction may end up under the surface, its density is still returned
+    __host__ __device__ inline DirectionSample ggxReflection(const Vector<float>& normal, const Vector<float>& incoming, const float alpha, const float u1, const float u2) {
+        const float a2 = alpha*alpha;
+        const float cos2 = (1.f - u1) / (1.f + (a2 - 1.f) * u1);
+        const float cosTheta = std::sqrt(cos2);
+        const float sinTheta = std::sqrt(Utils::max(0.f, 1.f - cos2));
+        float sine, cosine;
+        sinCos2Pi(u2, sine, cosine);
+        const Vector<float> half = toWorld(normal, sinTheta * cosine, sinTheta * sine, cosTheta);
+        const float dot = incoming*half;
+        return {incoming - half*(2.f*dot), ggxD(cosTheta, alpha) * cosTheta / (4.f * fabsf(dot))};
+    }
+
+    // Density ggxReflection gives to outgoing
+    __host__ __device__ inline float ggxReflectionPdf(const Vector<float>& normal, const Vector<float>& incoming, const Vector<float>& outgoing, const float alpha) {
+        const Vector<float> half = (outgoing - incoming).normalize();
+        const float cosTheta = fabsf(half*normal);
+        return ggxD(cosTheta, alpha) * cosTheta / (4.f * fabsf(incoming*half));
+    }
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "cuda_compat.hpp"
+
+#if (defined(__SSE2__) || defined(__AVX__)) && !defined(__CUDA_ARCH__)
+#include <immintrin.h>
+#endif
+
+/*
+The widest float lanes the host compiler targets : 8 with AVX (-mavx or -march=native), 4 with SSE2.
+Only the operations the leaf triangle blocks need, see TriangleBlock and Ray::intersect(const TriangleBlock&, ...).
+*/
+namespace Simd {
+#if defined(__AVX__) && !defined(__CUDA_ARCH__)
+    constexpr uint WIDTH = 8;
+    typedef __m256 Lanes;
+
+    inline Lanes set1(const float x) { return _mm256_set1_ps(x); }
+    inline Lanes load(const float* p) { return _mm256_load_ps(p); }
+    inline void store(float* p, const Lanes a) { _mm256_store_ps(p, a); }
+    inline Lanes add(const Lanes a, const Lanes b) { return _mm256_add_ps(a, b); }
+    inline Lanes sub(const Lanes a, const Lanes b) { return _mm256_sub_ps(a, b); }
+    inline Lanes mul(const Lanes a, const Lanes b) { return _mm256_mul_ps(a, b); }
+    inline Lanes div(const Lanes a, const Lanes b) { return _mm256_div_ps(a, b); }
+    inline Lanes min(const Lanes a, const Lanes b) { return _mm256_min_ps(a, b); }
+    inline Lanes andMask(const Lanes a, const Lanes b) { return _mm256_and_ps(a, b); }
+    inline Lanes andNot(const Lanes a, const Lanes b) { return _mm256_andnot_ps(a, b); }
+    inline Lanes orMask(const Lanes a, const Lanes b) { return _mm256_or_ps(a, b); }
+    inline Lanes xorMask(const Lanes a, const Lanes b) { return _mm256_xor_ps(a, b); }
+    inline Lanes cmpge(const Lanes a, const Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    inline Lanes cmplt(const Lanes a, const Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    inline Lanes cmpeq(const Lanes a, const Lanes b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    inline int moveMask(const Lanes a) { return _mm256_movemask_ps(a); }
+
+    // Every lane set to the smallest one
+    inline Lanes horizontalMin(const Lanes a) {
+        const Lanes m = _mm256_min_ps(a, _mm256_permute2f128_ps(a, a, 1));
+        const Lanes n = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm256_min_ps(n, _mm256_shuffle_ps(n, n, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+#elif defined(__SSE2__) && !defined(__CUDA_ARCH__)
+    constexpr uint WIDTH = 4;
+    typedef __m128 Lanes;
+
+    inline Lanes set1(const float x) { return _mm_set1_ps(x); }
+    inline Lanes load(const float* p) { return _mm_load_ps(p); }
+    inline void store(float* p, const Lanes a) { _mm_store_ps(p, a); }
+    inline Lanes add(const Lanes a, const Lanes b) { return _mm_add_ps(a, b); }
+    inline Lanes sub(const Lanes a, const Lanes b) { return _mm_sub_ps(a, b); }
+    inline Lanes mul(const Lanes a, const Lanes b) { return _mm_mul_ps(a, b); }
+    inline Lanes div(const Lanes a, const Lanes b) { return _mm_div_ps(a, b); }
+    inline Lanes min(const Lanes a, const Lanes b) { return _mm_min_ps(a, b); }
+    inline Lanes andMask(const Lanes a, const Lanes b) { return _mm_and_ps(a, b); }
+    inline Lanes andNot(const Lanes a, const Lanes b) { return _mm_andnot_ps(a, b); }
+    inline Lanes orMask(const Lanes a, const Lanes b) { return _mm_or_ps(a, b); }
+    inline Lanes xorMask(const Lanes a, const Lanes b) { return _mm_xor_ps(a, b); }
+    inline Lanes cmpge(const Lanes a, const Lanes b) { return _mm_cmpge_ps(a, b); }
+    inline Lanes cmplt(const Lanes a, const Lanes b) { return _mm_cmplt_ps(a, b); }
+    inline Lanes cmpeq(const Lanes a, const Lanes b) { return _mm_cmpeq_ps(a, b); }
+    inline int moveMask(const Lanes a) { return _mm_movemask_ps(a); }
+
+    inline Lanes horizontalMin(const Lanes a) {
+        const Lanes m = _mm_min_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+#else
+    constexpr uint WIDTH = 4; // Blocks keep their layout, their triangles are tested one by one
+#endif
+};
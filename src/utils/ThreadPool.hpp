@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Fixed set of worker threads running batches of independent tasks, e.g. the tiles of a frame.
+Each worker owns a deque : it takes its own tasks from the front and, once it runs dry, steals from the back of the others,
+so that a worker stuck on expensive tasks (mirror pixels with many bounces) is helped by the ones done with cheap ones.
+The calling thread takes part as worker 0.
+*/
+class ThreadPool {
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<uint> tasks;
+        };
+
+        std::vector<std::thread> threads;
+        std::vector<Queue> queues;
+        std::function<void(uint, uint)> job;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        uint generation = 0; // Batches started, wakes the workers
+        uint numRunning = 0; // Workers still in the current batch
+        std::atomic<uint> numStolen = 0;
+        bool stopping = false;
+
+        bool pop(const uint worker, uint& task) {
+            Queue& own = queues[worker];
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.tasks.empty()) {
+                    task = own.tasks.front();
+                    own.tasks.pop_front();
+                    return true;
+                }
+            }
+            for (uint k = 1; k < queues.size(); k++) {
+                Queue& victim = queues[(worker + k) % queues.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                    task = victim.tasks.back();
+                    victim.tasks.pop_back();
+                    numStolen++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void work(const uint worker) {
+            uint task;
+            while (pop(worker, task)) {
+                job(task, worker);
+            }
+        }
+
+        void loop(const uint worker) {
+            uint seen = 0;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&] { return stopping || generation != seen; });
+                    if (stopping) return;
+                    seen = generation;
+                }
+                work(worker);
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--numRunning == 0) done.notify_one();
+            }
+        }
+
+    public:
+        ThreadPool(const uint numThreads = std::thread::hardware_concurrency()) : queues(numThreads > 0 ? numThreads : 1) {
+            for (uint i = 1; i < queues.size(); i++) {
+                threads.emplace_back(&ThreadPool::loop, this, i);
+            }
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+        }
+
+        uint size() const {
+            return queues.size();
+        }
+
+        // Tasks stolen since the pool started
+        uint getNumStolen() const {
+            return numStolen;
+        }
+
+        /*
+        Runs task(i, worker) for every i in [0, numTasks) and returns once all are done.
+        Workers start on contiguous blocks of tasks, neighbouring tiles being likely to cost the same.
+        */
+        void run(const uint numTasks, const std::function<void(uint, uint)>& task) {
+            job = task;
+            const uint numWorkers = queues.size();
+            for (uint worker = 0; worker < numWorkers; worker++) {
+                std::lock_guard<std::mutex> lock(queues[worker].mutex);
+                for (uint i = worker * numTasks / numWorkers; i < (worker + 1) * numTasks / numWorkers; i++) {
+                    queues[worker].tasks.push_back(i);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                numRunning = numWorkers - 1;
+                generation++;
+            }
+            wake.notify_all();
+            work(0);
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&] { return numRunning == 0; });
+        }
+};
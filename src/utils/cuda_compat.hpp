@@ -0,0 +1,23 @@
+#pragma once
+
+/*
+CUDA runtime, or its stand-in for the host only build (make HOST_ONLY=1) on machines without GPU nor nvcc :
+the qualifiers compile away so that device code is plain host code, Array keeps its data on the host
+and the shaders are dispatched on a thread pool, see Shader.hpp.
+*/
+#ifdef HOST_ONLY
+    #define __host__
+    #define __device__
+    #define __global__
+
+    enum cudaError {
+        cudaSuccess = 0
+    };
+    typedef cudaError cudaError_t;
+
+    inline const char* cudaGetErrorString(const cudaError err) {
+        return err == cudaSuccess ? "no error" : "unknown error";
+    }
+#else
+    #include <cuda_runtime.h>
+#endif
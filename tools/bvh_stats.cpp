@@ -0,0 +1,91 @@
+/*
+Builds the BVH of one model with the given parameters and prints its statistics as one JSON object.
+Usage : bvh_stats <model.obj> [--scale s] [--bins n] [--traversal-cost c] [--intersection-cost c] [--max-depth n]
+                              [--spatial] [--max-duplication f] [--linear] [--leaf-size n] [--layout build|dfs|veb]
+                              [--block-width n]
+--block-width defaults to TriangleBlock::WIDTH in the host only build and to 1 otherwise, see BVHParams.
+The model is looked up in ./models/, like Environment::addObj does.
+*/
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+
+#include "Obj.hpp"
+#include "BVH.hpp"
+#include "BVHStats.hpp"
+
+void cudaAssert(const cudaError err, const char *file, const int line) {
+    if (cudaSuccess != err) {
+        fprintf(stderr, "Cuda error in file '%s' in line %i : %s.\n", file, line, cudaGetErrorString(err));
+        exit(1);
+    }
+}
+
+int usage() {
+    std::cerr << "Usage : bvh_stats <model.obj> [--scale s] [--bins n] [--traversal-cost c] [--intersection-cost c] [--max-depth n]"
+        << " [--spatial] [--max-duplication f] [--linear] [--leaf-size n] [--layout build|dfs|veb]"
+        << " [--block-width n]" << std::endl;
+    return EXIT_FAILURE;
+}
+
+// Same names as --layout
+const char* layoutName(const NodeLayout layout) {
+    switch (layout) {
+        case NodeLayout::DepthFirst: return "dfs";
+        case NodeLayout::VanEmdeBoas: return "veb";
+        default: return "build";
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) return usage();
+    const std::string name = argv[1];
+    float scale = 0.5f;
+    BVHParams params;
+    for (int i = 2; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--spatial") params.spatialSplits = true;
+        else if (arg == "--linear") params.linearBuild = true;
+        else if (arg == "--scale" && hasValue) scale = atof(argv[++i]);
+        else if (arg == "--bins" && hasValue) params.numBins = atoi(argv[++i]);
+        else if (arg == "--traversal-cost" && hasValue) params.traversalCost = atof(argv[++i]);
+        else if (arg == "--intersection-cost" && hasValue) params.intersectionCost = atof(argv[++i]);
+        else if (arg == "--max-depth" && hasValue) params.maxDepth = atoi(argv[++i]);
+        else if (arg == "--max-duplication" && hasValue) params.maxDuplication = atof(argv[++i]);
+        else if (arg == "--leaf-size" && hasValue) params.linearLeafSize = atoi(argv[++i]);
+        else if (arg == "--block-width" && hasValue) params.blockWidth = atoi(argv[++i]);
+        else if (arg == "--layout" && hasValue) {
+            const std::string layout = argv[++i];
+            if (layout == "build") params.layout = NodeLayout::Build;
+            else if (layout == "dfs") params.layout = NodeLayout::DepthFirst;
+            else if (layout == "veb") params.layout = NodeLayout::VanEmdeBoas;
+            else return usage();
+        }
+        else return usage();
+    }
+
+    Obj obj = Obj(name);
+    IndexedMesh mesh = obj.toMesh(Vector<float>(), scale, Material());
+    if (mesh.size() == 0) {
+        std::cerr << "No triangle loaded from " << obj.getPath() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    BVH bvh = BVH(mesh, params);
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<float, std::milli> elapsed = end - start;
+
+    const BVHStats stats = BVHStats::Compute(bvh);
+    std::cout << "{\"model\": \"" << name << "\", \"buildMs\": " << elapsed.count() << ", \"params\": {\"bins\": " << params.numBins
+        << ", \"traversalCost\": " << params.traversalCost << ", \"intersectionCost\": " << params.intersectionCost
+        << ", \"maxDepth\": " << params.maxDepth << ", \"spatialSplits\": " << (params.spatialSplits ? "true" : "false")
+        << ", \"maxDuplication\": " << params.maxDuplication << ", \"linearBuild\": " << (params.linearBuild ? "true" : "false")
+        << ", \"linearLeafSize\": " << params.linearLeafSize << ", \"layout\": \"" << layoutName(params.layout) << "\", \"blockWidth\": " << params.blockWidth << "}, \"stats\": " << stats.toJSON() << "}" << std::endl;
+
+    bvh.free();
+    mesh.free(); // Not owned by the BVH
+    return stats.maxStackDepth <= stats.stackSize ? EXIT_SUCCESS : EXIT_FAILURE;
+}